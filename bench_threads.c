@@ -0,0 +1,129 @@
+#include "word_filter.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+//lookups per second of 1, 2, 4... threads searching one context:
+//without a lock, under wf_brlock and under a pthread rwlock.
+//a lookup is wf_search_word_category with the word list, as check() of the lua binding does
+#define MAX_THREAD 256
+#define TEXT_NUM 1024
+
+enum { MODE_NONE, MODE_BRLOCK, MODE_RWLOCK };
+static const char* mode_name[] = {"none", "wf_brlock", "pthread_rwlock"};
+
+static wordfilterctxptr g_ctx;
+static struct wf_brlock* g_brlock;
+static pthread_rwlock_t g_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+static char* g_text[TEXT_NUM];
+static volatile int g_stop;
+
+//one cache line each, the threads count in locals and write them here once
+struct bench_arg {
+	int mode;
+	int seed;
+	uint64_t lookups;
+	int found;
+} __attribute__((aligned(64)));
+
+static void
+random_word(char* buf, int len, unsigned* seed) {
+	int i;
+	for (i = 0; i < len; i++) buf[i] = 'a' + rand_r(seed) % 26;
+	buf[len] = '\0';
+}
+
+static double
+now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void*
+bench_lookup(void* p) {
+	struct bench_arg* arg = (struct bench_arg*)p;
+	int i = arg->seed % TEXT_NUM, mode = arg->mode, found = 0;
+	uint64_t lookups = 0;
+	while (!g_stop) {
+		strnodeptr list = NULL;
+		uint32_t hit = 0;
+		if (mode == MODE_BRLOCK) wf_brlock_rlock(g_brlock);
+		else if (mode == MODE_RWLOCK) pthread_rwlock_rdlock(&g_rwlock);
+		found += wf_search_word_category(g_ctx, g_text[i], WF_CATEGORY_ALL, &list, &hit) > 0;
+		if (mode == MODE_BRLOCK) wf_brlock_runlock(g_brlock);
+		else if (mode == MODE_RWLOCK) pthread_rwlock_unlock(&g_rwlock);
+		wf_free_str_list(list);
+		lookups++;
+		if (++i == TEXT_NUM) i = 0;
+	}
+	arg->lookups = lookups;
+	arg->found = found;
+	return NULL;
+}
+
+static double
+bench(int mode, int threads, double seconds) {
+	struct bench_arg args[MAX_THREAD];
+	pthread_t tid[MAX_THREAD];
+	int i, started = 0;
+	g_stop = 0;
+	for (i = 0; i < threads; i++) {
+		args[i] = (struct bench_arg){mode, i * 97, 0, 0};
+		if (pthread_create(&tid[i], NULL, bench_lookup, &args[i]) != 0) break;
+		started++;
+	}
+	double begin = now();
+	usleep((useconds_t)(seconds * 1e6));
+	g_stop = 1;
+	uint64_t lookups = 0;
+	for (i = 0; i < started; i++) {
+		pthread_join(tid[i], NULL);
+		lookups += args[i].lookups;
+	}
+	return lookups / (now() - begin);
+}
+
+int main(int argc, char **argv) {
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	int maxthread = argc > 1 ? atoi(argv[1]) : (int)(cores > 0 ? cores * 2 : 2);
+	int wordnum = argc > 2 ? atoi(argv[2]) : 100000;
+	double seconds = argc > 3 ? atof(argv[3]) : 1.0;
+	if (maxthread < 1) maxthread = 1;
+	if (maxthread > MAX_THREAD) maxthread = MAX_THREAD;
+
+	unsigned seed = 1;
+	char buf[512];
+	int i, mode, threads;
+	g_ctx = wf_create_ctx();
+	for (i = 0; i < wordnum; i++) {
+		random_word(buf, 4 + rand_r(&seed) % 6, &seed);
+		wf_insert_word(g_ctx, buf);
+	}
+	//chat sized texts, a few of them hit
+	for (i = 0; i < TEXT_NUM; i++) {
+		random_word(buf, 32 + rand_r(&seed) % 96, &seed);
+		g_text[i] = strdup(buf);
+	}
+	g_brlock = wf_brlock_create();
+
+	printf("cores:%ld words:%d seconds:%.1f\n", cores, wordnum, seconds);
+	printf("%-8s", "threads");
+	for (mode = MODE_NONE; mode <= MODE_RWLOCK; mode++) printf("%18s", mode_name[mode]);
+	printf("\n");
+	for (threads = 1; threads <= maxthread; threads = threads < maxthread && threads * 2 > maxthread ? maxthread : threads * 2) {
+		printf("%-8d", threads);
+		for (mode = MODE_NONE; mode <= MODE_RWLOCK; mode++)
+			printf("%18.0f", bench(mode, threads, seconds));
+		printf("\n");
+		if (threads == maxthread) break;
+	}
+
+	wf_brlock_free(g_brlock);
+	for (i = 0; i < TEXT_NUM; i++) free(g_text[i]);
+	wf_free_ctx(g_ctx);
+	return 0;
+}
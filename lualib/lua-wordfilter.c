@@ -10,40 +10,83 @@
 #define UNLOCK(pl) __sync_lock_release(pl);
 
 
-struct rwlock {
-	pthread_rwlock_t lock;
-};
-
-static inline void
-rwlock_init(struct rwlock *lock) {
-	pthread_rwlock_init(&lock->lock, NULL);
-}
-
+/*
+ * the filters are read under wf_brlock:check and filter only write a slot of their thread, never g_ctx_lock.
+ * g_ctx_lock orders the writers, which change g_ctx_instance under the write lock of the id.
+ */
 static inline void
-rwlock_rlock(struct rwlock *lock) {
-	 pthread_rwlock_rdlock(&lock->lock);
+rwlock_rlock(struct wf_brlock **lock) {
+	wf_brlock_rlock(*lock);
 }
 
 static inline void
-rwlock_wlock(struct rwlock *lock) {
-	 pthread_rwlock_wrlock(&lock->lock);
+rwlock_wlock(struct wf_brlock **lock) {
+	wf_brlock_wlock(*lock);
 }
 
 static inline void
-rwlock_wunlock(struct rwlock *lock) {
-	pthread_rwlock_unlock(&lock->lock);
+rwlock_wunlock(struct wf_brlock **lock) {
+	wf_brlock_wunlock(*lock);
 }
 
 static inline void
-rwlock_runlock(struct rwlock *lock) {
-	pthread_rwlock_unlock(&lock->lock);
+rwlock_runlock(struct wf_brlock **lock) {
+	wf_brlock_runlock(*lock);
 }
 
 
 typedef int lock;
 static lock g_ctx_lock;
 static wordfilterctxptr g_ctx_instance[MAX_FILTER_NUM] = {NULL};
-static struct rwlock g_rwlock[MAX_FILTER_NUM];
+static struct wf_brlock* g_rwlock[MAX_FILTER_NUM];
+static pthread_once_t g_rwlock_once = PTHREAD_ONCE_INIT;
+
+//the locks live as long as the process, every lua state loading the module shares them
+static void
+rwlock_create() {
+	int i;
+	for (i=0; i<MAX_FILTER_NUM; i++)
+		g_rwlock[i] = wf_brlock_create();
+}
+
+//result cache of check and filter, sharded by the text
+#define CACHE_SHARDS 16
+static pthread_mutex_t g_cache_lock[CACHE_SHARDS] = {[0 ... CACHE_SHARDS-1] = PTHREAD_MUTEX_INITIALIZER};
+static struct wf_cache* g_cache[CACHE_SHARDS] = {NULL};
+
+static inline int
+cache_shard(const char* str, size_t len) {
+	if (len == 0) return 0;
+	return (len * 31 + (byte)str[0] * 7 + (byte)str[len/2] * 13 + (byte)str[len-1]) % CACHE_SHARDS;
+}
+
+//check(outstr NULL) or filter through the cache, the shard lock is held for the lookup and the store,
+//not for the scan of a miss. it is not taken while the cache is off
+static int
+cache_word(wordfilterctxptr ctx, const char* word, size_t len, uint32_t catmask,
+	strnodeptr* strlist, char* outstr, uint32_t* hitmask) {
+	int shard = cache_shard(word, len);
+	int cached = __atomic_load_n(&g_cache[shard], __ATOMIC_RELAXED) != NULL;
+	if (cached) {
+		pthread_mutex_lock(&g_cache_lock[shard]);
+		int find = wf_cache_lookup(g_cache[shard], ctx, word, catmask, strlist, outstr, hitmask);
+		pthread_mutex_unlock(&g_cache_lock[shard]);
+		if (find != WF_CACHE_MISS) return find;
+	}
+	strnodeptr list = NULL;
+	uint32_t hit = 0;
+	int find = outstr ? wf_filter_word_category(ctx, word, catmask, &list, outstr, &hit)
+		: wf_search_word_category(ctx, word, catmask, &list, &hit);
+	if (cached) {
+		pthread_mutex_lock(&g_cache_lock[shard]);
+		wf_cache_store(g_cache[shard], ctx, word, catmask, find, list, outstr, hit);
+		pthread_mutex_unlock(&g_cache_lock[shard]);
+	}
+	if (strlist) *strlist = list;
+	else wf_free_str_list(list);
+	if (hitmask) *hitmask = hit;
+	return find;
+}
 
 
 int
@@ -69,9 +112,48 @@ lnewctx(lua_State *L) {
 		UNLOCK(&g_ctx_lock);
 		luaL_error(L, "[wordfilter.newctx]: alloc context error");
 	}
-	rwlock_init(&g_rwlock[filter_id-1]);
 	wf_set_ignore_case(ctx, ignorecase);
+	rwlock_wlock(&g_rwlock[filter_id-1]);
 	g_ctx_instance[filter_id-1] = ctx;
+	rwlock_wunlock(&g_rwlock[filter_id-1]);
+	UNLOCK(&g_ctx_lock);
+	lua_pushboolean(L, 1);
+	return 1;
+}
+
+int
+lclonectx(lua_State *L) {
+	int filter_id = lua_tointeger(L, 1);
+	int new_filter_id = lua_tointeger(L, 2);
+
+	if (filter_id < 1 || filter_id > MAX_FILTER_NUM || new_filter_id < 1 || new_filter_id > MAX_FILTER_NUM) {
+		luaL_error(L, "[wordfilter.clonectx]: filter id overstep the boundary:[%d,%d]",
+						filter_id, new_filter_id);
+	}
+
+	LOCK(&g_ctx_lock);
+	wordfilterctxptr ctx = g_ctx_instance[filter_id-1];
+	if (!ctx) {
+		UNLOCK(&g_ctx_lock);
+		luaL_error(L, "[wordfilter.clonectx]: filter no created,filter id:[%d]",
+						filter_id);
+	}
+	if (g_ctx_instance[new_filter_id-1]) {
+		UNLOCK(&g_ctx_lock);
+		luaL_error(L, "[wordfilter.clonectx]: already create filter,filter id:[%d]",
+						new_filter_id);
+	}
+
+	rwlock_rlock(&g_rwlock[filter_id-1]);
+	wordfilterctxptr newctx = wf_clone_ctx(ctx);
+	rwlock_runlock(&g_rwlock[filter_id-1]);
+	if (!newctx) {
+		UNLOCK(&g_ctx_lock);
+		luaL_error(L, "[wordfilter.clonectx]: alloc context error");
+	}
+	rwlock_wlock(&g_rwlock[new_filter_id-1]);
+	g_ctx_instance[new_filter_id-1] = newctx;
+	rwlock_wunlock(&g_rwlock[new_filter_id-1]);
 	UNLOCK(&g_ctx_lock);
 	lua_pushboolean(L, 1);
 	return 1;
@@ -112,8 +194,8 @@ lfreectx(lua_State *L) {
 		}
 		rwlock_wlock(&g_rwlock[filter_id-1]);
 		wf_free_ctx(ctx);
-		rwlock_wunlock(&g_rwlock[filter_id-1]);
 		g_ctx_instance[filter_id-1] = NULL;
+		rwlock_wunlock(&g_rwlock[filter_id-1]);
 		UNLOCK(&g_ctx_lock);
 	} else {
 		luaL_error(L, "[wordfilter.freectx]: filter id overstep the boundary:[%d]",
@@ -137,8 +219,94 @@ lsetignorecase(lua_State *L) {
 		luaL_error(L, "[wordfilter.setignorecase]: filter no created,filter id:[%d]",
 						filter_id);
 	}
+	rwlock_wlock(&g_rwlock[filter_id-1]);
 	wf_set_ignore_case(ctx, ignorecase);
+	rwlock_wunlock(&g_rwlock[filter_id-1]);
+	UNLOCK(&g_ctx_lock);
+	return 0;
+}
+
+//must be used before the words are updated
+int
+lsetcodepoint(lua_State *L) {
+	int filter_id = lua_tointeger(L, 1);
+	if (filter_id < 1 || filter_id > MAX_FILTER_NUM) {
+		luaL_error(L, "[wordfilter.setcodepoint]: filter id overstep the boundary:[%d]",
+						filter_id);
+	}
+	int enable = lua_toboolean(L, 2);
+	LOCK(&g_ctx_lock);
+	wordfilterctxptr ctx = g_ctx_instance[filter_id-1];
+	if (!ctx) {
+		UNLOCK(&g_ctx_lock);
+		luaL_error(L, "[wordfilter.setcodepoint]: filter no created,filter id:[%d]",
+						filter_id);
+	}
+	rwlock_wlock(&g_rwlock[filter_id-1]);
+	UNLOCK(&g_ctx_lock);
+	int ok = wf_set_codepoint(ctx, enable);
+	rwlock_wunlock(&g_rwlock[filter_id-1]);
+	lua_pushboolean(L, ok);
+	return 1;
+}
+
+int
+lsetutf8(lua_State *L) {
+	int filter_id = lua_tointeger(L, 1);
+	if (filter_id < 1 || filter_id > MAX_FILTER_NUM) {
+		luaL_error(L, "[wordfilter.setutf8]: filter id overstep the boundary:[%d]",
+						filter_id);
+	}
+	int enable = lua_toboolean(L, 2);
+	LOCK(&g_ctx_lock);
+	wordfilterctxptr ctx = g_ctx_instance[filter_id-1];
+	if (!ctx) {
+		UNLOCK(&g_ctx_lock);
+		luaL_error(L, "[wordfilter.setutf8]: filter no created,filter id:[%d]",
+						filter_id);
+	}
+	rwlock_wlock(&g_rwlock[filter_id-1]);
+	UNLOCK(&g_ctx_lock);
+	wf_set_utf8(ctx, enable);
+	rwlock_wunlock(&g_rwlock[filter_id-1]);
+	return 0;
+}
+
+//the budget argument of one check, filter or filterspan, 0 if it is not given(the one of setbudget applies)
+static int
+opt_budget(lua_State *L, int idx, const char* name, uint32_t* budget) {
+	if (lua_isnoneornil(L, idx)) return 0;
+	lua_Integer n = luaL_checkinteger(L, idx);
+	if (n < 0 || n > 0xFFFFFFFF) {
+		luaL_error(L, "[wordfilter.%s]: budget overstep the boundary:[%d]", name, (int)n);
+	}
+	*budget = n;
+	return 1;
+}
+
+//the trie steps a check or filter may take, 0:no limit. they return exceeded=true when stopped
+int
+lsetbudget(lua_State *L) {
+	int filter_id = lua_tointeger(L, 1);
+	if (filter_id < 1 || filter_id > MAX_FILTER_NUM) {
+		luaL_error(L, "[wordfilter.setbudget]: filter id overstep the boundary:[%d]",
+						filter_id);
+	}
+	lua_Integer budget = luaL_checkinteger(L, 2);
+	if (budget < 0 || budget > 0xFFFFFFFF) {
+		luaL_error(L, "[wordfilter.setbudget]: budget overstep the boundary:[%d]", (int)budget);
+	}
+	LOCK(&g_ctx_lock);
+	wordfilterctxptr ctx = g_ctx_instance[filter_id-1];
+	if (!ctx) {
+		UNLOCK(&g_ctx_lock);
+		luaL_error(L, "[wordfilter.setbudget]: filter no created,filter id:[%d]",
+						filter_id);
+	}
+	rwlock_wlock(&g_rwlock[filter_id-1]);
 	UNLOCK(&g_ctx_lock);
+	wf_set_budget(ctx, budget);
+	rwlock_wunlock(&g_rwlock[filter_id-1]);
 	return 0;
 }
 
@@ -162,11 +330,38 @@ lsetmaskword(lua_State *L) {
 		luaL_error(L, "[wordfilter.setmaskword]: filter no created,filter id:[%d]",
 						filter_id);
 	}
+	rwlock_wlock(&g_rwlock[filter_id-1]);
 	wf_set_mask_word(ctx, maskword[0]);
+	rwlock_wunlock(&g_rwlock[filter_id-1]);
 	UNLOCK(&g_ctx_lock);
 	return 0;
 }
 
+int
+laddequiv(lua_State *L) {
+	int filter_id = lua_tointeger(L, 1);
+	if (filter_id < 1 || filter_id > MAX_FILTER_NUM) {
+		luaL_error(L, "[wordfilter.addequiv]: filter id overstep the boundary:[%d]",
+						filter_id);
+	}
+	const char* canonical = luaL_checkstring(L, 2);
+	const char* variants = luaL_checkstring(L, 3);
+
+	LOCK(&g_ctx_lock);
+	wordfilterctxptr ctx = g_ctx_instance[filter_id-1];
+	if (!ctx) {
+		UNLOCK(&g_ctx_lock);
+		luaL_error(L, "[wordfilter.addequiv]: filter no created,filter id:[%d]",
+						filter_id);
+	}
+	rwlock_wlock(&g_rwlock[filter_id-1]);
+	UNLOCK(&g_ctx_lock);
+	int ok = wf_add_equiv(ctx, canonical, variants);
+	rwlock_wunlock(&g_rwlock[filter_id-1]);
+	lua_pushboolean(L, ok);
+	return 1;
+}
+
 int
 lupdateskipword(lua_State *L) {
 	int filter_id = lua_tointeger(L, 1);
@@ -207,6 +402,46 @@ lupdateskipword(lua_State *L) {
 	return 0;
 }
 
+int
+lupdateallowword(lua_State *L) {
+	int filter_id = lua_tointeger(L, 1);
+	if (filter_id < 1 || filter_id > MAX_FILTER_NUM) {
+		luaL_error(L, "[wordfilter.updateallowword]: filter id overstep the boundary:[%d]",
+						filter_id);		
+	}
+	if (!lua_istable(L, 2)) {
+		luaL_error(L, "[wordfilter.updateallowword]: table expect, got type[%s]",
+						lua_typename(L, lua_type(L, 2)));
+	}
+
+	LOCK(&g_ctx_lock);
+	wordfilterctxptr ctx = g_ctx_instance[filter_id-1];
+	if (!ctx) {
+		UNLOCK(&g_ctx_lock);
+		luaL_error(L, "[wordfilter.updateallowword]: filter no created,filter id:[%d]",
+						filter_id);
+	}
+	rwlock_wlock(&g_rwlock[filter_id-1]);
+	UNLOCK(&g_ctx_lock);
+
+	int success = 1;
+	lua_pushnil(L);
+	while (lua_next(L, -2)) {
+		const char* word = lua_tostring(L, -1);
+		if (!wf_insert_allow_word(ctx, word)) {
+			success = 0;
+			rwlock_wunlock(&g_rwlock[filter_id-1]);
+			luaL_error(L, "[wordfilter.updateallowword]: insert word error[%s]",
+							word);
+		}
+		lua_pop(L, 1);
+	}
+	rwlock_wunlock(&g_rwlock[filter_id-1]);
+
+	lua_pushboolean(L, success);
+	return 0;
+}
+
 int
 lupdateword(lua_State *L) {
 	int filter_id = lua_tointeger(L, 1);
@@ -219,6 +454,14 @@ lupdateword(lua_State *L) {
 		luaL_error(L, "[wordfilter.updateword]: table expect, got type[%s]",
 						lua_typename(L, lua_type(L, 2)));
 	}
+	int category = luaL_optinteger(L, 3, WF_CATEGORY_DEFAULT);
+	int severity = luaL_optinteger(L, 4, 0);
+	int wholeword = lua_toboolean(L, 5);
+	if (category <= 0 || category > WF_CATEGORY_ALL || severity < 0 || severity > 0xFF) {
+		luaL_error(L, "[wordfilter.updateword]: category or severity overstep the boundary:[%d,%d]",
+						category, severity);
+	}
+	lua_settop(L, 2);
 
 	LOCK(&g_ctx_lock);
 	wordfilterctxptr ctx = g_ctx_instance[filter_id-1];
@@ -240,7 +483,9 @@ lupdateword(lua_State *L) {
 							lua_typename(L, lua_type(L, -1)));
 		}
 		const char* word = lua_tostring(L, -1);
-		if (!wf_insert_word(ctx, word)) {
+		int ok = wholeword ? wf_insert_whole_word(ctx, word, category, severity)
+			: wf_insert_word_ex(ctx, word, category, severity);
+		if (!ok) {
 			success = 0;
 			rwlock_wunlock(&g_rwlock[filter_id-1]);
 			luaL_error(L, "[wordfilter.updateword]: insert word error[%s]",
@@ -254,6 +499,60 @@ lupdateword(lua_State *L) {
 	return 1;
 }
 
+int
+lupdatepattern(lua_State *L) {
+	int filter_id = lua_tointeger(L, 1);
+	if (filter_id < 1 || filter_id > MAX_FILTER_NUM) {
+		luaL_error(L, "[wordfilter.updatepattern]: filter id overstep the boundary:[%d]",
+						filter_id);
+	}
+
+	if (!lua_istable(L, 2)) {
+		luaL_error(L, "[wordfilter.updatepattern]: table expect, got type[%s]",
+						lua_typename(L, lua_type(L, 2)));
+	}
+	int category = luaL_optinteger(L, 3, WF_CATEGORY_DEFAULT);
+	int severity = luaL_optinteger(L, 4, 0);
+	if (category <= 0 || category > WF_CATEGORY_ALL || severity < 0 || severity > 0xFF) {
+		luaL_error(L, "[wordfilter.updatepattern]: category or severity overstep the boundary:[%d,%d]",
+						category, severity);
+	}
+	lua_settop(L, 2);
+
+	LOCK(&g_ctx_lock);
+	wordfilterctxptr ctx = g_ctx_instance[filter_id-1];
+	if (!ctx) {
+		UNLOCK(&g_ctx_lock);
+		luaL_error(L, "[wordfilter.updatepattern]: filter no created,filter id:[%d]",
+						filter_id);
+	}
+
+	rwlock_wlock(&g_rwlock[filter_id-1]);
+	UNLOCK(&g_ctx_lock);
+
+	int success = 1;
+	lua_pushnil(L);
+	while (lua_next(L, -2)) {
+		if (lua_type(L, -1) != LUA_TSTRING) {
+			rwlock_wunlock(&g_rwlock[filter_id-1]);
+			luaL_error(L, "[wordfilter.updatepattern]: string expect, got type[%s]",
+							lua_typename(L, lua_type(L, -1)));
+		}
+		const char* word = lua_tostring(L, -1);
+		if (!wf_insert_pattern(ctx, word, category, severity)) {
+			success = 0;
+			rwlock_wunlock(&g_rwlock[filter_id-1]);
+			luaL_error(L, "[wordfilter.updatepattern]: insert pattern error[%s]",
+							word);
+		}
+		lua_pop(L, 1);
+	}
+	rwlock_wunlock(&g_rwlock[filter_id-1]);
+
+	lua_pushboolean(L, success);
+	return 1;
+}
+
 int
 lfilter(lua_State *L) {
 	int filter_id = lua_tointeger(L, 1);
@@ -273,23 +572,29 @@ lfilter(lua_State *L) {
 		return 1;
 	}
 
-	LOCK(&g_ctx_lock);
+	uint32_t catmask = luaL_optinteger(L, 3, WF_CATEGORY_ALL);
+	uint32_t budget = 0;
+	int hasbudget = opt_budget(L, 4, "filter", &budget);
+
+	rwlock_rlock(&g_rwlock[filter_id-1]);
 	wordfilterctxptr ctx = g_ctx_instance[filter_id-1];
 	if (!ctx) {
-		UNLOCK(&g_ctx_lock);
+		rwlock_runlock(&g_rwlock[filter_id-1]);
 		luaL_error(L, "[wordfilter.filter]: filter no created,filter id:[%d]",
 						filter_id);
 	}
 
-	rwlock_rlock(&g_rwlock[filter_id-1]);
-	UNLOCK(&g_ctx_lock);
-
 	char wordstartptr[str_len+1];
 	strnodeptr strlist = NULL;
 	memset(wordstartptr, 0, (str_len+1)*sizeof(char));
-	int isfilter = wf_filter_word(ctx, word, &strlist, wordstartptr);
+	uint32_t hitmask = 0;
+	//the cached results are of the budget of setbudget
+	int isfilter = hasbudget ? wf_filter_word_budget(ctx, word, catmask, &strlist, wordstartptr, &hitmask, budget)
+		: cache_word(ctx, word, str_len, catmask, &strlist, wordstartptr, &hitmask);
 
 	rwlock_runlock(&g_rwlock[filter_id-1]);
+	int exceeded = isfilter == WF_BUDGET_EXCEEDED;
+	if (exceeded) isfilter = hitmask != 0;
 
 	lua_pushboolean(L, isfilter);
 	lua_pushstring(L, wordstartptr);
@@ -302,7 +607,63 @@ lfilter(lua_State *L) {
 		p = p->next;
 	}
 	if (strlist) wf_free_str_list(strlist);
-	return 3;
+	lua_pushinteger(L, hitmask);
+	lua_pushboolean(L, exceeded);
+	return 5;
+}
+
+//the ranges to mask as a flat array {start1, end1, start2, end2, ...}, 1-based and inclusive like string.sub
+int
+lfilterspan(lua_State *L) {
+	int filter_id = lua_tointeger(L, 1);
+	if (filter_id < 1 || filter_id > MAX_FILTER_NUM) {
+		luaL_error(L, "[wordfilter.filterspan]: filter id overstep the boundary:[%d]",
+						filter_id);
+	}
+	if (lua_type(L, 2) != LUA_TSTRING) {
+		luaL_error(L, "[wordfilter.filterspan]: string expect, got type:[%s]",
+						lua_typename(L, lua_type(L, 2)));
+	}
+
+	const char* word = lua_tostring(L, 2);
+	uint32_t catmask = luaL_optinteger(L, 3, WF_CATEGORY_ALL);
+	uint32_t budget = 0;
+	int hasbudget = opt_budget(L, 4, "filterspan", &budget);
+
+	rwlock_rlock(&g_rwlock[filter_id-1]);
+	wordfilterctxptr ctx = g_ctx_instance[filter_id-1];
+	if (!ctx) {
+		rwlock_runlock(&g_rwlock[filter_id-1]);
+		luaL_error(L, "[wordfilter.filterspan]: filter no created,filter id:[%d]",
+						filter_id);
+	}
+
+	struct wf_span_list spans = {0};
+	uint32_t hitmask = 0;
+	int isfilter = hasbudget ? wf_filter_span_budget(ctx, word, catmask, &spans, &hitmask, budget)
+		: wf_filter_span(ctx, word, catmask, &spans, &hitmask);
+
+	rwlock_runlock(&g_rwlock[filter_id-1]);
+
+	int exceeded = isfilter == WF_BUDGET_EXCEEDED;
+	if (exceeded) isfilter = spans.num != 0;
+	if (isfilter < 0) {
+		wf_free_span_list(&spans);
+		luaL_error(L, "[wordfilter.filterspan]: out of memory");
+	}
+	lua_pushboolean(L, isfilter);
+	lua_createtable(L, spans.num * 2, 0);
+	uint32_t i;
+	for (i=0; i<spans.num; i++) {
+		lua_pushinteger(L, spans.span[i << 1] + 1);
+		lua_rawseti(L, -2, (i << 1) + 1);
+		lua_pushinteger(L, spans.span[(i << 1) + 1]);
+		lua_rawseti(L, -2, (i << 1) + 2);
+	}
+	wf_free_span_list(&spans);
+	lua_pushinteger(L, hitmask);
+	lua_pushboolean(L, exceeded);
+	return 4;
 }
 
 int
@@ -317,25 +678,32 @@ lcheck(lua_State *L) {
 						lua_typename(L, lua_type(L, 2)));
 	}
 
-	const char* word = lua_tostring(L, 2);
+	size_t str_len;
+	const char* word = lua_tolstring(L, 2, &str_len);
 	if (word == NULL) {
 		lua_pushboolean(L, 0);
 		return 1;
 	}
 
-	LOCK(&g_ctx_lock);
+	uint32_t catmask = luaL_optinteger(L, 3, WF_CATEGORY_ALL);
+	uint32_t budget = 0;
+	int hasbudget = opt_budget(L, 4, "check", &budget);
+
+	rwlock_rlock(&g_rwlock[filter_id-1]);
 	wordfilterctxptr ctx = g_ctx_instance[filter_id-1];
 	if (!ctx) {
-		UNLOCK(&g_ctx_lock);
+		rwlock_runlock(&g_rwlock[filter_id-1]);
 		luaL_error(L, "[wordfilter.check]: filter no created,filter id:[%d]",
 						filter_id);
 	}
-	rwlock_rlock(&g_rwlock[filter_id-1]);
-	UNLOCK(&g_ctx_lock);
 
 	strnodeptr strlist = NULL;
-	int find = wf_search_word_ex(ctx, word, &strlist);
+	uint32_t hitmask = 0;
+	int find = hasbudget ? wf_search_word_budget(ctx, word, catmask, &strlist, &hitmask, budget)
+		: cache_word(ctx, word, str_len, catmask, &strlist, NULL, &hitmask);
 	rwlock_runlock(&g_rwlock[filter_id-1]);
+	int exceeded = find == WF_BUDGET_EXCEEDED;
+	if (exceeded) find = hitmask != 0;
 
 	lua_pushboolean(L, find);
 	lua_newtable(L);
@@ -347,7 +715,9 @@ lcheck(lua_State *L) {
 		p = p->next;
 	}
 	if (strlist) wf_free_str_list(strlist);
-	return 2;
+	lua_pushinteger(L, hitmask);
+	lua_pushboolean(L, exceeded);
+	return 4;
 }
 
 int
@@ -373,6 +743,310 @@ lempty(lua_State *L) {
 	return 1;
 }
 
+//size:the cached results of all shards, 0 turns the cache off
+int
+lsetcache(lua_State *L) {
+	lua_Integer size = luaL_checkinteger(L, 1);
+	if (size < 0 || size > 0x7FFFFFFF) {
+		luaL_error(L, "[wordfilter.setcache]: cache size overstep the boundary:[%d]", (int)size);
+	}
+	uint32_t shard_size = size ? (size + CACHE_SHARDS - 1) / CACHE_SHARDS : 0;
+	int i;
+	for (i=0; i<CACHE_SHARDS; i++) {
+		struct wf_cache* cache = shard_size ? wf_cache_create(shard_size) : NULL;
+		pthread_mutex_lock(&g_cache_lock[i]);
+		struct wf_cache* old = g_cache[i];
+		__atomic_store_n(&g_cache[i], cache, __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&g_cache_lock[i]);
+		wf_cache_free(old);
+	}
+	return 0;
+}
+
+//return hit, miss
+int
+lcachestat(lua_State *L) {
+	uint64_t hit = 0, miss = 0;
+	int i;
+	for (i=0; i<CACHE_SHARDS; i++) {
+		uint64_t shard_hit, shard_miss;
+		pthread_mutex_lock(&g_cache_lock[i]);
+		wf_cache_stat(g_cache[i], &shard_hit, &shard_miss);
+		pthread_mutex_unlock(&g_cache_lock[i]);
+		hit += shard_hit;
+		miss += shard_miss;
+	}
+	lua_pushinteger(L, hit);
+	lua_pushinteger(L, miss);
+	return 2;
+}
+
+#ifndef _WIN32
+//publish the context to shared memory, return the generation(0:failed)
+int
+lshmpublish(lua_State *L) {
+	int filter_id = lua_tointeger(L, 1);
+	if (filter_id < 1 || filter_id > MAX_FILTER_NUM) {
+		luaL_error(L, "[wordfilter.shmpublish]: filter id overstep the boundary:[%d]",
+						filter_id);
+	}
+	const char* name = luaL_checkstring(L, 2);
+
+	LOCK(&g_ctx_lock);
+	wordfilterctxptr ctx = g_ctx_instance[filter_id-1];
+	if (!ctx) {
+		UNLOCK(&g_ctx_lock);
+		luaL_error(L, "[wordfilter.shmpublish]: filter no created,filter id:[%d]",
+						filter_id);
+	}
+	rwlock_rlock(&g_rwlock[filter_id-1]);
+	UNLOCK(&g_ctx_lock);
+	uint64_t generation = wf_shm_publish(ctx, name);
+	rwlock_runlock(&g_rwlock[filter_id-1]);
+	lua_pushinteger(L, generation);
+	return 1;
+}
+
+//map the newest generation into the filter id, an old context there is replaced
+int
+lshmattach(lua_State *L) {
+	int filter_id = lua_tointeger(L, 1);
+	if (filter_id < 1 || filter_id > MAX_FILTER_NUM) {
+		luaL_error(L, "[wordfilter.shmattach]: filter id overstep the boundary:[%d]",
+						filter_id);
+	}
+	const char* name = luaL_checkstring(L, 2);
+	wordfilterctxptr newctx = wf_shm_attach(name);
+	if (!newctx) {
+		lua_pushboolean(L, 0);
+		return 1;
+	}
+
+	LOCK(&g_ctx_lock);
+	rwlock_wlock(&g_rwlock[filter_id-1]);
+	wordfilterctxptr ctx = g_ctx_instance[filter_id-1];
+	g_ctx_instance[filter_id-1] = newctx;
+	rwlock_wunlock(&g_rwlock[filter_id-1]);
+	UNLOCK(&g_ctx_lock);
+	wf_free_ctx(ctx);
+	lua_pushboolean(L, 1);
+	return 1;
+}
+
+int
+lshmstale(lua_State *L) {
+	int filter_id = lua_tointeger(L, 1);
+	if (filter_id < 1 || filter_id > MAX_FILTER_NUM) {
+		luaL_error(L, "[wordfilter.shmstale]: filter id overstep the boundary:[%d]",
+						filter_id);
+	}
+	LOCK(&g_ctx_lock);
+	wordfilterctxptr ctx = g_ctx_instance[filter_id-1];
+	int stale = ctx ? wf_shm_stale(ctx) : 0;
+	UNLOCK(&g_ctx_lock);
+	lua_pushboolean(L, stale);
+	return 1;
+}
+#endif
+
+#ifdef __linux__
+/*
+ * every lua state that calls asyncstart gets workers and an eventfd of its own, kept in its registry,
+ * so poll only returns the jobs submitted by the same state, a service never gets the results of another.
+ * the workers stop when the state is closed.
+ */
+#define ASYNC_POLL_BATCH 64
+
+struct lasync {
+	struct wf_async* async;
+	uint64_t tag;
+	int num;   //results polled
+	int done;  //results returned to lua, the rest(after a lua error) are returned by the next poll
+	struct wf_async_result results[ASYNC_POLL_BATCH];
+};
+
+static int g_async_key; //the registry key of the lasync userdata
+
+//run in the workers, the key is the filter index
+static wordfilterctxptr
+async_acquire(void* ud, uint32_t key) {
+	rwlock_rlock(&g_rwlock[key]);
+	wordfilterctxptr ctx = g_ctx_instance[key];
+	if (!ctx) rwlock_runlock(&g_rwlock[key]);
+	return ctx;
+}
+
+static void
+async_release(void* ud, uint32_t key) {
+	rwlock_runlock(&g_rwlock[key]);
+}
+
+static struct lasync*
+async_get(lua_State *L) {
+	lua_rawgetp(L, LUA_REGISTRYINDEX, &g_async_key);
+	struct lasync* la = (struct lasync*)lua_touserdata(L, -1);
+	lua_pop(L, 1);
+	return la;
+}
+
+static int
+lasyncgc(lua_State *L) {
+	struct lasync* la = (struct lasync*)lua_touserdata(L, 1);
+	for (; la->done < la->num; la->done++)
+		wf_async_free_result(&la->results[la->done]);
+	wf_async_free(la->async);
+	la->async = NULL;
+	return 0;
+}
+
+//start the workers of this lua state(once), return the eventfd that is readable when there are results to poll
+int
+lasyncstart(lua_State *L) {
+	int threads = luaL_optinteger(L, 1, 2);
+	int size = luaL_optinteger(L, 2, 1024);
+	struct lasync* la = async_get(L);
+	if (!la) {
+		la = (struct lasync*)lua_newuserdatauv(L, sizeof(*la), 0);
+		memset(la, 0, sizeof(*la));
+		lua_createtable(L, 0, 1);
+		lua_pushcfunction(L, lasyncgc);
+		lua_setfield(L, -2, "__gc");
+		lua_setmetatable(L, -2);
+		la->async = wf_async_create(threads, size, async_acquire, async_release, NULL);
+		if (!la->async) {
+			luaL_error(L, "[wordfilter.asyncstart]: create workers error");
+		}
+		lua_rawsetp(L, LUA_REGISTRYINDEX, &g_async_key);
+	}
+	lua_pushinteger(L, wf_async_fd(la->async));
+	return 1;
+}
+
+//submit(id, str, catmask, isfilter), return the job id, or nil if the workers are full
+int
+lsubmit(lua_State *L) {
+	int filter_id = lua_tointeger(L, 1);
+	if (filter_id < 1 || filter_id > MAX_FILTER_NUM) {
+		luaL_error(L, "[wordfilter.submit]: filter id overstep the boundary:[%d]",
+						filter_id);
+	}
+	if (lua_type(L, 2) != LUA_TSTRING) {
+		luaL_error(L, "[wordfilter.submit]: string expect, got type:[%s]",
+						lua_typename(L, lua_type(L, 2)));
+	}
+	const char* word = lua_tostring(L, 2);
+	uint32_t catmask = luaL_optinteger(L, 3, WF_CATEGORY_ALL);
+	int op = lua_toboolean(L, 4) ? WF_ASYNC_FILTER : WF_ASYNC_CHECK;
+	struct lasync* la = async_get(L);
+	if (!la) {
+		luaL_error(L, "[wordfilter.submit]: asyncstart first");
+	}
+	uint64_t tag = la->tag + 1;
+	if (!wf_async_submit(la->async, NULL, filter_id-1, op, word, catmask, tag)) {
+		lua_pushnil(L);
+		return 1;
+	}
+	la->tag = tag;
+	lua_pushinteger(L, tag);
+	return 1;
+}
+
+//poll(max), return {{id=, isfilter=, str=(filter only), hitmask=}, ...}, it never blocks.
+//the results are polled into the lasync first, a result is freed after its table is in the list
+int
+lpoll(lua_State *L) {
+	int max = luaL_optinteger(L, 1, 256);
+	struct lasync* la = async_get(L);
+	lua_newtable(L);
+	if (!la) return 1;
+	int i = 1, drained = 0;
+	while (i <= max) {
+		if (la->done == la->num) {
+			int want = max - i + 1 < ASYNC_POLL_BATCH ? max - i + 1 : ASYNC_POLL_BATCH;
+			if (drained) break;
+			la->done = la->num = 0;
+			la->num = wf_async_poll(la->async, la->results, want);
+			if (la->num < want) drained = 1;
+			if (la->num == 0) break;
+		}
+		struct wf_async_result* result = &la->results[la->done];
+		lua_createtable(L, 0, 4);
+		lua_pushinteger(L, result->tag);
+		lua_setfield(L, -2, "id");
+		lua_pushboolean(L, result->find > 0 || (result->find == WF_BUDGET_EXCEEDED && result->hitmask));
+		lua_setfield(L, -2, "isfilter");
+		if (result->find == WF_BUDGET_EXCEEDED) {
+			lua_pushboolean(L, 1);
+			lua_setfield(L, -2, "exceeded");
+		}
+		if (result->outstr) {
+			lua_pushstring(L, result->outstr);
+			lua_setfield(L, -2, "str");
+		}
+		lua_pushinteger(L, result->hitmask);
+		lua_setfield(L, -2, "hitmask");
+		if (result->find == -1) {
+			lua_pushstring(L, "filter no created");
+			lua_setfield(L, -2, "err");
+		}
+		lua_rawseti(L, -2, i++);
+		la->done++;
+		wf_async_free_result(result);
+	}
+	return 1;
+}
+#endif
+
+int
+lcompact(lua_State *L) {
+	int filter_id = lua_tointeger(L, 1);
+	if (filter_id < 1 || filter_id > MAX_FILTER_NUM) {
+		luaL_error(L, "[wordfilter.compact]: filter id overstep the boundary:[%d]",
+						filter_id);
+	}
+
+	LOCK(&g_ctx_lock);
+	wordfilterctxptr ctx = g_ctx_instance[filter_id-1];
+	if (!ctx) {
+		UNLOCK(&g_ctx_lock);
+		luaL_error(L, "[wordfilter.compact]: filter no created,filter id:[%d]",
+						filter_id);
+	}
+	rwlock_wlock(&g_rwlock[filter_id-1]);
+	UNLOCK(&g_ctx_lock);
+
+	size_t reclaimed = wf_compact(ctx);
+	rwlock_wunlock(&g_rwlock[filter_id-1]);
+
+	lua_pushinteger(L, reclaimed);
+	return 1;
+}
+
+int
+lminimize(lua_State *L) {
+	int filter_id = lua_tointeger(L, 1);
+	if (filter_id < 1 || filter_id > MAX_FILTER_NUM) {
+		luaL_error(L, "[wordfilter.minimize]: filter id overstep the boundary:[%d]",
+						filter_id);
+	}
+
+	LOCK(&g_ctx_lock);
+	wordfilterctxptr ctx = g_ctx_instance[filter_id-1];
+	if (!ctx) {
+		UNLOCK(&g_ctx_lock);
+		luaL_error(L, "[wordfilter.minimize]: filter no created,filter id:[%d]",
+						filter_id);
+	}
+	rwlock_wlock(&g_rwlock[filter_id-1]);
+	UNLOCK(&g_ctx_lock);
+
+	size_t reclaimed = wf_minimize(ctx);
+	rwlock_wunlock(&g_rwlock[filter_id-1]);
+
+	lua_pushinteger(L, reclaimed);
+	return 1;
+}
+
 int
 lmemory(lua_State *L) {
 	lua_pushinteger(L, wf_get_memsize());
@@ -413,18 +1087,41 @@ lcapacity(lua_State *L) {
 int
 luaopen_wordfilter(lua_State *L) {
 	luaL_checkversion(L);
+	pthread_once(&g_rwlock_once, rwlock_create);
 	luaL_Reg l[] = {
 		{"newctx",         lnewctx},
+		{"clonectx",       lclonectx},
 		{"cleanctx",       lcleanctx},
 		{"freectx",        lfreectx},
 		{"setignorecase",  lsetignorecase},
+		{"setcodepoint",   lsetcodepoint},
+		{"setutf8",        lsetutf8},
+		{"setbudget",      lsetbudget},
 		{"setmaskword",    lsetmaskword},
+		{"addequiv",       laddequiv},
 		{"updateskipword", lupdateskipword},
 		{"updateword",     lupdateword},
+		{"updateallowword",lupdateallowword},
+		{"updatepattern",  lupdatepattern},
 	  	{"filter", 	       lfilter},
+	  	{"filterspan",     lfilterspan},
 	  	{"check",          lcheck},
 	  	{"empty",          lempty},
 	  	{"memory",         lmemory},
+		{"compact",        lcompact},
+		{"minimize",       lminimize},
+		{"setcache",       lsetcache},
+		{"cachestat",      lcachestat},
+#ifndef _WIN32
+		{"shmpublish",     lshmpublish},
+		{"shmattach",      lshmattach},
+		{"shmstale",       lshmstale},
+#endif
+#ifdef __linux__
+		{"asyncstart",     lasyncstart},
+		{"submit",         lsubmit},
+		{"poll",           lpoll},
+#endif
 		{"capacity",       lcapacity},
 	  	{NULL, NULL}
 	};
@@ -2,6 +2,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+#ifdef __linux__
+#include <poll.h>
+#endif
 
 char *usecase[] = {
 	"helloworld",
@@ -50,6 +55,59 @@ char *badword[] = {
 	"xx.XXX.com"
 };
 
+//a word file, one word per line
+static void
+load_words(wordfilterctxptr ctx, const char* filename, int (*insert)(wordfilterctxptr, const char*)) {
+	FILE* fp = fopen(filename, "r");
+	char line[256];
+	while (fp && fgets(line, sizeof(line), fp)) {
+		size_t len = strlen(line);
+		while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r')) line[--len] = '\0';
+		if (len > 0) insert(ctx, line);
+	}
+	if (fp) fclose(fp);
+}
+
+//the matches tried at every position by wf_match_at, which doesn't use the prefilter
+static int
+match_everywhere(wordfilterctxptr ctx, const char* text) {
+	const char* p = text;
+	const char* allow_end = text;
+	int find = 0;
+	while (*p) {
+		char key[WF_MAX_WORD_LENGTH + 1];
+		uint32_t value;
+		int allow;
+		int ret = wf_match_at(ctx, text, p, key, WF_CATEGORY_ALL, &value, &allow);
+		if (p + allow > allow_end) allow_end = p + allow;
+		if (ret && p + ret > allow_end) {
+			find++;
+			p += ret;
+		} else {
+			p++;
+		}
+	}
+	return find;
+}
+
+//the same words, dumped by wf_gen(see Makefile)
+extern const struct wf_static_dict test_dict;
+
+struct brlock_arg {
+	wordfilterctxptr ctx;
+	struct wf_brlock* lock;
+	char outstr[64];
+};
+
+static void*
+brlock_reader(void* p) {
+	struct brlock_arg* arg = (struct brlock_arg*)p;
+	wf_brlock_rlock(arg->lock);
+	wf_filter_word(arg->ctx, "a new word", NULL, arg->outstr);
+	wf_brlock_runlock(arg->lock);
+	return NULL;
+}
+
 int main(int argc, char **argv) {
 	wordfilterctxptr ctx = wf_create_ctx();
 	wf_set_ignore_case(ctx, 1);
@@ -97,6 +155,415 @@ int main(int argc, char **argv) {
 	wf_search_word(ctx, "...屏...蔽...", string);
 	printf("test:%s", string);
 
+	printf("\n------------test \"wf_filter_word_category\":\n");
+	wordfilterctxptr catctx = wf_create_ctx();
+	wf_insert_word_ex(catctx, "bad", 0x1, 1);
+	wf_insert_word_ex(catctx, "badword", 0x2, 3);
+	wf_insert_word_ex(catctx, "xx.com", 0x4, 2);
+	wf_insert_word_ex(catctx, "xx.com", 0x1, 5);
+	const char* catcase = "a badword from xx.com is bad";
+	for (uint32_t catmask = 1; catmask <= 0x7; catmask++) {
+		strnodeptr strlist;
+		uint32_t hitmask;
+		char newstr[strlen(catcase) + 1];
+		wf_filter_word_category(catctx, catcase, catmask, &strlist, newstr, &hitmask);
+		printf("catmask:%u hitmask:%u newstr:%s\n", catmask, hitmask, newstr);
+		strnodeptr p = strlist;
+		while (p) {
+			printf("bad word:%s category:%u severity:%u\n", p->str, p->category, p->severity);
+			p = p->next;
+		}
+		wf_free_str_list(strlist);
+	}
+	wf_free_ctx(catctx);
+
+
+	printf("------------test \"wf_clone_ctx\":\n");
+	wordfilterctxptr clonectx = wf_clone_ctx(ctx);
+	wf_insert_word(clonectx, "test");
+	for (int i = 0; i < 2; i++) {
+		wordfilterctxptr c = i == 0 ? ctx : clonectx;
+		char newstr[strlen(usecase[8]) + 1];
+		wf_filter_word(c, usecase[8], NULL, newstr);
+		printf("%s:%s\n", i == 0 ? "origin" : "clone", newstr);
+	}
+	wf_free_ctx(clonectx);
+
+	printf("------------test \"wf_compact\":\n");
+	size_t reclaimed = wf_compact(ctx);
+	printf("reclaimed:%s\n", reclaimed > 0 ? "yes" : "no");
+	for (int i = 10; i < 20; i++) {
+		char newstr[strlen(usecase[i]) + 1];
+		wf_filter_word(ctx, usecase[i], NULL, newstr);
+		printf("usecase[%d]:%s\n", i, newstr);
+	}
+	wf_insert_word(ctx, "test");
+	wf_insert_word(ctx, "screen");
+	char newstr[strlen(usecase[9]) + 1];
+	wf_filter_word(ctx, usecase[9], NULL, newstr);
+	printf("after insert:%s\n", newstr);
+
+
+	printf("------------test chain split:\n");
+	wordfilterctxptr chainctx = wf_create_ctx();
+	const char* chainword[] = {"chainword", "chain", "chainwork", "ch", "chainwordlonger"};
+	for (int i = 0; i < sizeof(chainword)/sizeof(*chainword); i++) {
+		wf_insert_word(chainctx, chainword[i]);
+		strnodeptr strlist;
+		wf_search_word_ex(chainctx, "chainworklonger chainwordlonger chai", &strlist);
+		printf("insert %s:", chainword[i]);
+		for (strnodeptr p = strlist; p; p = p->next) printf(" %s", p->str);
+		printf("\n");
+		wf_free_str_list(strlist);
+	}
+	wf_free_ctx(chainctx);
+
+	printf("------------test \"wf_minimize\":\n");
+	wordfilterctxptr dawgctx = wf_clone_ctx(ctx);
+	printf("reclaimed:%s\n", wf_minimize(dawgctx) > 0 ? "yes" : "no");
+	for (int i = 0; i < sizeof(usecase)/sizeof(*usecase); i++) {
+		char newstr1[strlen(usecase[i]) + 1], newstr2[strlen(usecase[i]) + 1];
+		wf_filter_word(ctx, usecase[i], NULL, newstr1);
+		wf_filter_word(dawgctx, usecase[i], NULL, newstr2);
+		if (strcmp(newstr1, newstr2) != 0) printf("usecase[%d] differ:%s %s\n", i, newstr1, newstr2);
+	}
+	printf("insert after minimize:%d\n", wf_insert_word(dawgctx, "test"));
+	char dawgstr[strlen(usecase[8]) + 1];
+	wf_filter_word(dawgctx, usecase[8], NULL, dawgstr);
+	printf("overlay:%s\n", dawgstr);
+	//a word in both tries gets the categories of both and the higher severity
+	wf_insert_word_ex(dawgctx, "bad", 0x2, 9);
+	strnodeptr dawglist;
+	uint32_t dawghit;
+	wf_search_word_category(dawgctx, "bad", WF_CATEGORY_ALL, &dawglist, &dawghit);
+	printf("insert again:hitmask %u severity %u\n", dawghit, dawglist ? dawglist->severity : 0);
+	wf_free_str_list(dawglist);
+	wf_free_ctx(dawgctx);
+
+	printf("------------test \"wf_open_static\":\n");
+	wordfilterctxptr srcctx = wf_create_ctx();
+	wf_set_ignore_case(srcctx, 1);
+	load_words(srcctx, "test_words.txt", wf_insert_word);
+	load_words(srcctx, "test_skip.txt", wf_insert_skip_word);
+	wordfilterctxptr staticctx = wf_open_static(&test_dict);
+	int staticdiffer = 0;
+	for (int layer = 0; layer < 2; layer++) {
+		if (layer) {
+			wf_insert_word(srcctx, "test");
+			printf("insert into static:%d\n", wf_insert_word(staticctx, "test"));
+		}
+		for (int i = 0; i < sizeof(usecase)/sizeof(*usecase); i++) {
+			char newstr1[strlen(usecase[i]) + 1], newstr2[strlen(usecase[i]) + 1];
+			strnodeptr list1, list2, p1, p2;
+			int find1 = wf_filter_word(srcctx, usecase[i], &list1, newstr1);
+			int find2 = wf_filter_word(staticctx, usecase[i], &list2, newstr2);
+			for (p1 = list1, p2 = list2; p1 && p2 && strcmp(p1->str, p2->str) == 0; p1 = p1->next, p2 = p2->next);
+			if (find1 != find2 || strcmp(newstr1, newstr2) != 0 || p1 || p2) {
+				printf("usecase[%d] differ:%s %s\n", i, newstr1, newstr2);
+				staticdiffer++;
+			}
+			wf_free_str_list(list1);
+			wf_free_str_list(list2);
+		}
+	}
+	char staticstr[strlen(usecase[8]) + 1];
+	wf_filter_word(staticctx, usecase[8], NULL, staticstr);
+	printf("static:%s differ:%d\n", staticstr, staticdiffer);
+	wf_free_ctx(staticctx);
+	wf_free_ctx(srcctx);
+
+	printf("------------test \"wf_add_equiv\":\n");
+	wordfilterctxptr equivctx = wf_create_ctx();
+	wf_set_ignore_case(equivctx, 1);
+	wf_add_equiv(equivctx, "a", "@4\xd0\xb0");
+	wf_add_equiv(equivctx, "s", "5$");
+	wf_insert_word(equivctx, "bad");
+	wf_insert_word(equivctx, "shit");
+	wf_insert_skip_word(equivctx, " ");
+	const char* equivcase = "B@d b\xd0\xb0 d 5hit $HIT sh1t";
+	char equivstr[strlen(equivcase) + 1];
+	wf_filter_word(equivctx, equivcase, NULL, equivstr);
+	printf("equiv:%s\n", equivstr);
+	printf("add after insert:%d\n", wf_add_equiv(equivctx, "i", "1"));
+	wf_free_ctx(equivctx);
+
+	printf("------------test \"wf_insert_allow_word\":\n");
+	wordfilterctxptr allowctx = wf_create_ctx();
+	wf_set_ignore_case(allowctx, 1);
+	wf_insert_word(allowctx, "ass");
+	wf_insert_word(allowctx, "cunt");
+	wf_insert_allow_word(allowctx, "classic");
+	wf_insert_allow_word(allowctx, "scunthorpe");
+	wf_insert_allow_word(allowctx, "ass");
+	wf_insert_word(allowctx, "assassin");
+	const char* allowcase = "a classic ass from Scunthorpe, assassin cunt";
+	char allowstr[strlen(allowcase) + 1];
+	wf_filter_word(allowctx, allowcase, NULL, allowstr);
+	printf("allow:%s\n", allowstr);
+	wf_free_ctx(allowctx);
+
+	printf("------------test \"wf_insert_whole_word\":\n");
+	wordfilterctxptr wholectx = wf_create_ctx();
+	wf_set_ignore_case(wholectx, 1);
+	wf_insert_whole_word(wholectx, "ass", WF_CATEGORY_DEFAULT, 0);
+	wf_insert_whole_word(wholectx, "hell", WF_CATEGORY_DEFAULT, 0);
+	wf_insert_word(wholectx, "shit");
+	const char* wholecase = "Ass, class, hello, \xc3\xa9hell, hell! bullshitting";
+	char wholestr[strlen(wholecase) + 1];
+	wf_filter_word(wholectx, wholecase, NULL, wholestr);
+	printf("whole:%s\n", wholestr);
+	wf_insert_word(wholectx, "ass"); //inserted again as a plain word
+	wf_filter_word(wholectx, wholecase, NULL, wholestr);
+	printf("plain again:%s\n", wholestr);
+	wordfilterctxptr wholedawg = wf_clone_ctx(wholectx);
+	wf_minimize(wholedawg);
+	printf("whole on minimized:%d", wf_insert_whole_word(wholedawg, "ass", WF_CATEGORY_DEFAULT, 0));
+	wf_filter_word(wholedawg, wholecase, NULL, wholestr);
+	printf(" %s\n", wholestr);
+	wf_free_ctx(wholedawg);
+	wf_free_ctx(wholectx);
+
+	printf("------------test \"wf_insert_pattern\":\n");
+	wordfilterctxptr patternctx = wf_create_ctx();
+	wf_set_ignore_case(patternctx, 1);
+	printf("insert pattern:%d\n", wf_insert_pattern(patternctx, "w?e?c?h?a?t", WF_CATEGORY_DEFAULT, 0));
+	printf("insert pattern:%d\n", wf_insert_pattern(patternctx, "加{0,3}微{0,3}信", WF_CATEGORY_DEFAULT, 0));
+	printf("insert bad pattern:%d\n", wf_insert_pattern(patternctx, "{1,2}qq", WF_CATEGORY_DEFAULT, 0));
+	const char* patterncase = "add W_E_C_H_A_T or 加x微xx信, 加微信, 加abcd微信";
+	char patternstr[strlen(patterncase) + 1];
+	wf_filter_word(patternctx, patterncase, NULL, patternstr);
+	printf("pattern:%s\n", patternstr);
+	//8 gaps that almost match:every start position tries 9^8 gap lengths without the memo
+	wf_insert_pattern(patternctx, "a{0,8}a{0,8}a{0,8}a{0,8}a{0,8}a{0,8}a{0,8}a{0,8}b", WF_CATEGORY_DEFAULT, 0);
+	char gapcase[65], gapstr[65];
+	memset(gapcase, 'a', 64);
+	gapcase[64] = '\0';
+	clock_t gapclock = clock();
+	int gapfind = wf_filter_word(patternctx, gapcase, NULL, gapstr);
+	printf("8 gaps:%d fast:%d\n", gapfind, clock() - gapclock < CLOCKS_PER_SEC);
+	//the fillers of a gap are counted as one word
+	struct wf_counter* gapcounter = wf_counter_create();
+	wf_count_word(patternctx, gapcounter, patterncase, WF_CATEGORY_ALL);
+	wf_count_word(patternctx, gapcounter, "w.e.c.h.a.t", WF_CATEGORY_ALL);
+	struct wf_word_count gapwords[4];
+	uint32_t gapnum = wf_counter_top(gapcounter, gapwords, 4, NULL, NULL);
+	for (uint32_t i = 0; i < gapnum; i++)
+		printf("%llu %s\n", (unsigned long long)gapwords[i].count, gapwords[i].word);
+	wf_counter_free(gapcounter);
+	wf_free_ctx(patternctx);
+
+	printf("------------test \"wf_insert_words\":\n");
+	{
+		const char* words[] = {"bad", "word", "test", "屏蔽", "屏蔽词", "我是", "hello"};
+		wordfilterctxptr c = wf_create_ctx();
+		wf_insert_skip_word(c, " ");
+		printf("insert:%d\n", wf_insert_words(c, words, sizeof(words)/sizeof(*words), WF_CATEGORY_DEFAULT, 0, 4));
+		for (int i = 14; i < 17; i++) {
+			char newstr[strlen(usecase[i]) + 1];
+			wf_filter_word(c, usecase[i], NULL, newstr);
+			printf("%s -> %s\n", usecase[i], newstr);
+		}
+		wf_free_ctx(c);
+	}
+
+	printf("------------test \"wf_set_codepoint\":\n");
+	{
+		wordfilterctxptr c = wf_create_ctx();
+		wf_set_ignore_case(c, 1);
+		printf("set:%d\n", wf_set_codepoint(c, 1));
+		wf_insert_skip_word(c, " ");
+		wf_insert_skip_word(c, "~");
+		wf_insert_word(c, "屏蔽词");
+		wf_insert_word(c, "Bad Word");
+		for (int i = 14; i < 19; i++) {
+			char newstr[strlen(usecase[i]) + 1];
+			wf_filter_word(c, usecase[i], NULL, newstr);
+			printf("%s -> %s\n", usecase[i], newstr);
+		}
+		wf_free_ctx(c);
+	}
+
+	printf("------------test \"wf_set_utf8\":\n");
+	{
+		wordfilterctxptr c = wf_create_ctx();
+		wf_set_utf8(c, 1);
+		wf_insert_skip_word(c, "~");
+		wf_insert_word(c, "屏蔽词");
+		const char* texts[] = {"我~是~屏~蔽~词~", "\xff我是屏蔽词\xe5", "我是\xe5屏蔽词"};
+		for (int i = 0; i < 3; i++) {
+			char newstr[strlen(texts[i]) + 1];
+			wf_filter_word(c, texts[i], NULL, newstr);
+			printf("valid:%d/%d %s -> %s\n", (int)wf_utf8_valid(texts[i], strlen(texts[i])), (int)strlen(texts[i]), texts[i], newstr);
+		}
+		wf_free_ctx(c);
+	}
+
+	printf("------------test \"wf_set_budget\":\n");
+	{
+		wordfilterctxptr c = wf_create_ctx();
+		wf_insert_skip_word(c, "*");
+		wf_insert_word(c, "bad");
+		wf_insert_word(c, "aaaaaaaaaaaaaaaaaaaab");
+		const char* text = "bad a*a*a*a*a*a*a*a*a*a*a*a*a*a*a*a*a*a*a* bad";
+		char newstr[strlen(text) + 1];
+		for (int i = 0; i < 2; i++) {
+			wf_set_budget(c, i ? 100 : 0);
+			int ret = wf_filter_word(c, text, NULL, newstr);
+			printf("budget:%d ret:%d %s\n", i ? 100 : 0, ret, newstr);
+		}
+		//"bad" is matched before the steps run out on "badl"
+		wf_insert_word(c, "badly");
+		wf_set_budget(c, 4);
+		char partstr[6];
+		strnodeptr partlist;
+		uint32_t parthit;
+		int partret = wf_filter_word_category(c, "badlx", WF_CATEGORY_ALL, &partlist, partstr, &parthit);
+		printf("budget:4 ret:%d %s list:%s hitmask:%u\n", partret, partstr, partlist ? partlist->str : "", parthit);
+		wf_free_str_list(partlist);
+		//the budget of one call, the context keeps its own
+		partret = wf_filter_word_budget(c, "badlx", WF_CATEGORY_ALL, NULL, partstr, NULL, 0);
+		printf("call budget:0 ret:%d %s\n", partret, partstr);
+		wf_free_ctx(c);
+	}
+
+	printf("------------test prefilter:\n");
+	{
+		wordfilterctxptr skipctx = wf_create_ctx();
+		wf_insert_skip_word(skipctx, "*");
+		wf_insert_word(skipctx, "bad");
+		wordfilterctxptr eqctx = wf_create_ctx();
+		wf_set_ignore_case(eqctx, 1);
+		wf_add_equiv(eqctx, "a", "@4");
+		wf_insert_word(eqctx, "bad");
+		wordfilterctxptr layerctx = wf_clone_ctx(ctx);
+		wf_minimize(layerctx);
+		wf_insert_word(layerctx, "zzz");
+		struct {const char* name; wordfilterctxptr c; const char* text;} cases[] = {
+			{"after skip", skipctx, "x**bad *b*a*d"},
+			{"equiv", eqctx, "B@D b4d bad"},
+			{"layered", layerctx, "a zzz b"},
+			{"clean", ctx, "plain ok text"},
+		};
+		//the words found with the bitmap are the words found without it
+		for (int i = 0; i < sizeof(cases)/sizeof(*cases); i++) {
+			char newstr[strlen(cases[i].text) + 1];
+			struct wf_counter* counter = wf_counter_create();
+			int count = wf_count_word(cases[i].c, counter, cases[i].text, WF_CATEGORY_ALL);
+			wf_counter_free(counter);
+			wf_filter_word(cases[i].c, cases[i].text, NULL, newstr);
+			printf("%s:%s matches:%d everywhere:%d\n", cases[i].name, newstr, count, match_everywhere(cases[i].c, cases[i].text));
+		}
+		wf_free_ctx(skipctx);
+		wf_free_ctx(eqctx);
+		wf_free_ctx(layerctx);
+	}
+
+	printf("------------test \"wf_filter_span\":\n");
+	struct wf_span_list spans = {0};
+	for (int i = 14; i < 16; i++) {
+		wf_filter_span(ctx, usecase[i], WF_CATEGORY_ALL, &spans, NULL);
+		printf("usecase[%d]:%s\nspans:", i, usecase[i]);
+		for (uint32_t j = 0; j < spans.num; j++)
+			printf(" [%u,%u)", spans.span[j*2], spans.span[j*2+1]);
+		printf("\n");
+	}
+	wf_free_span_list(&spans);
+
+	printf("------------test \"wf_cache_filter_word\":\n");
+	struct wf_cache* cache = wf_cache_create(64);
+	for (int i = 0; i < 3; i++) {
+		char cachestr[strlen(usecase[8]) + 1];
+		wf_cache_filter_word(cache, ctx, usecase[8], WF_CATEGORY_ALL, NULL, cachestr, NULL);
+		printf("cache:%s\n", cachestr);
+		if (i == 1) wf_insert_word(ctx, "is");
+	}
+	uint64_t cachehit, cachemiss;
+	wf_cache_stat(cache, &cachehit, &cachemiss);
+	printf("hit:%llu miss:%llu\n", (unsigned long long)cachehit, (unsigned long long)cachemiss);
+	//a cache shared by threads:lock around the lookup and the store, scan unlocked
+	for (int i = 0; i < 2; i++) {
+		uint32_t cachemask;
+		int cachefind = wf_cache_lookup(cache, ctx, usecase[9], WF_CATEGORY_ALL, NULL, NULL, &cachemask);
+		printf("lookup:%d", cachefind);
+		if (cachefind == WF_CACHE_MISS) {
+			strnodeptr cachelist;
+			cachefind = wf_search_word_category(ctx, usecase[9], WF_CATEGORY_ALL, &cachelist, &cachemask);
+			wf_cache_store(cache, ctx, usecase[9], WF_CATEGORY_ALL, cachefind, cachelist, NULL, cachemask);
+			wf_free_str_list(cachelist);
+		}
+		printf(" find:%d\n", cachefind);
+	}
+	wf_cache_free(cache);
+
+	printf("------------test \"wf_count_word\":\n");
+	struct wf_counter* counter = wf_counter_create();
+	struct wf_counter* counter2 = wf_counter_create();
+	for (int i = 0; i < 13; i++)
+		wf_count_word(ctx, i & 1 ? counter2 : counter, usecase[i], WF_CATEGORY_ALL);
+	wf_counter_merge(counter, counter2);
+	struct wf_word_count topwords[3];
+	uint64_t counttotal;
+	uint32_t countnum, topnum = wf_counter_top(counter, topwords, 3, &counttotal, &countnum);
+	printf("matches:%llu words:%u\n", (unsigned long long)counttotal, countnum);
+	for (uint32_t i = 0; i < topnum; i++)
+		printf("%llu %s\n", (unsigned long long)topwords[i].count, topwords[i].word);
+	wf_counter_free(counter);
+	wf_counter_free(counter2);
+
+	printf("------------test \"wf_brlock\":\n");
+	struct brlock_arg brarg = {wf_clone_ctx(ctx), wf_brlock_create(), ""};
+	pthread_t brthread;
+	wf_brlock_wlock(brarg.lock);
+	pthread_create(&brthread, NULL, brlock_reader, &brarg); //waits for the writer
+	wf_insert_word(brarg.ctx, "new");
+	wf_brlock_wunlock(brarg.lock);
+	pthread_join(brthread, NULL);
+	printf("reader:%s\n", brarg.outstr);
+	wf_brlock_free(brarg.lock);
+	wf_free_ctx(brarg.ctx);
+
+#ifndef _WIN32
+	printf("------------test \"wf_shm_publish\":\n");
+	printf("generation:%llu\n", (unsigned long long)wf_shm_publish(ctx, "wf_test"));
+	wordfilterctxptr shmctx = wf_shm_attach("wf_test");
+	if (shmctx) {
+		char shmstr[strlen(usecase[8]) + 1];
+		wf_filter_word(shmctx, usecase[8], NULL, shmstr);
+		printf("attach:%s\n", shmstr);
+		wordfilterctxptr newctx = wf_create_ctx();
+		wf_insert_word(newctx, "test");
+		printf("generation:%llu\n", (unsigned long long)wf_shm_publish(newctx, "wf_test"));
+		printf("stale:%d\n", wf_shm_stale(shmctx));
+		wf_free_ctx(newctx);
+		wf_free_ctx(shmctx);
+	} else {
+		printf("no shared memory\n");
+	}
+	wf_shm_unlink("wf_test");
+#endif
+
+#ifdef __linux__
+	printf("------------test \"wf_async_submit\":\n");
+	struct wf_async* async = wf_async_create(2, 16, NULL, NULL, NULL);
+	for (int i = 5; i < 9; i++)
+		wf_async_submit(async, ctx, 0, i == 5 ? WF_ASYNC_CHECK : WF_ASYNC_FILTER, usecase[i], WF_CATEGORY_ALL, i);
+	struct wf_async_result results[4];
+	int resultnum = 0;
+	while (resultnum < 4) {
+		struct pollfd pfd = {wf_async_fd(async), POLLIN, 0};
+		poll(&pfd, 1, -1); //the event loop
+		resultnum += wf_async_poll(async, results + resultnum, 4 - resultnum);
+	}
+	for (int i = 5; i < 9; i++) {
+		for (int k = 0; k < 4; k++) {
+			if (results[k].tag != i) continue;
+			printf("job %d find:%d %s\n", i, results[k].find, results[k].outstr ? results[k].outstr : usecase[i]);
+			wf_async_free_result(&results[k]);
+		}
+	}
+	wf_async_free(async);
+#endif
+
 	wf_clean_ctx(ctx);
 	wf_free_ctx(ctx);
 
@@ -0,0 +1,32 @@
+#include "word_filter.hpp"
+#include <cstdio>
+
+int main() {
+	wf::filter filter;
+	filter.set_ignore_case(true);
+	filter.insert_word("bad");
+	filter.insert_word("bad word", 0x2, 3);
+	filter.insert_whole_word("ass");
+	filter.insert_skip_word("*");
+
+	std::string_view text = "this is a BAD*** word, not a class, ass";
+	printf("check:%d\n", filter.check(text));
+	printf("mask:%s\n", filter.mask(text).c_str());
+	filter.for_each(text, [](size_t pos, size_t len, std::string_view word, uint16_t category, byte severity) {
+		printf("match:%zu %zu %.*s %u %u\n", pos, len, (int)word.size(), word.data(), category, severity);
+	});
+
+	uint32_t hitmask = 0;
+	std::string masked = filter.mask(text, 0x2, &hitmask);
+	printf("mask category 0x2:%s hit:%u\n", masked.c_str(), hitmask);
+
+	wf::filter copy = filter.clone();
+	copy.insert_word("class");
+	printf("clone:%s\n", copy.mask(text).c_str());
+	printf("origin:%s\n", filter.mask(text).c_str());
+
+	//equivalence classes are matched by the C library
+	filter.add_equiv("a", "@");
+	printf("equiv:%s\n", filter.mask("b@d").c_str());
+	return 0;
+}
@@ -0,0 +1,275 @@
+#include "word_filter.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define MAX_THREAD 64
+
+//a dictionary file, one word per line
+static int
+load_words(wordfilterctxptr ctx, const char* filename, int (*insert)(wordfilterctxptr, const char*)) {
+	FILE* fp = fopen(filename, "r");
+	if (!fp) {
+		fprintf(stderr, "wf_count: can't open %s\n", filename);
+		return 0;
+	}
+	char line[1024];
+	int lineno = 0;
+	while (fgets(line, sizeof(line), fp)) {
+		size_t len = strlen(line);
+		lineno++;
+		while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r')) line[--len] = '\0';
+		if (len == 0) continue;
+		if (!insert(ctx, line)) {
+			fprintf(stderr, "wf_count: %s:%d insert word error[%s]\n", filename, lineno, line);
+			fclose(fp);
+			return 0;
+		}
+	}
+	fclose(fp);
+	return 1;
+}
+
+static int
+insert_whole_word(wordfilterctxptr ctx, const char* word) {
+	return wf_insert_whole_word(ctx, word, WF_CATEGORY_DEFAULT, 0);
+}
+
+//equivalence classes, one per line: canonical character then its variants
+static int
+load_equiv(wordfilterctxptr ctx, const char* filename) {
+	FILE* fp = fopen(filename, "r");
+	if (!fp) {
+		fprintf(stderr, "wf_count: can't open %s\n", filename);
+		return 0;
+	}
+	char line[1024];
+	int lineno = 0;
+	while (fgets(line, sizeof(line), fp)) {
+		char* canonical = strtok(line, " \t\r\n");
+		char* variants = canonical ? strtok(NULL, " \t\r\n") : NULL;
+		lineno++;
+		if (!canonical) continue;
+		if (!variants || !wf_add_equiv(ctx, canonical, variants)) {
+			fprintf(stderr, "wf_count: %s:%d add equivalence class error\n", filename, lineno);
+			fclose(fp);
+			return 0;
+		}
+	}
+	fclose(fp);
+	return 1;
+}
+
+//a log file mapped read only(read into memory on windows)
+struct log_file {
+	const char* data;
+	size_t size;
+};
+
+static int
+open_log(const char* filename, struct log_file* log) {
+#ifndef _WIN32
+	int fd = open(filename, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		if (fd >= 0) close(fd);
+		return 0;
+	}
+	log->size = st.st_size;
+	log->data = NULL;
+	if (log->size) {
+		void* data = mmap(NULL, log->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			close(fd);
+			return 0;
+		}
+		madvise(data, log->size, MADV_SEQUENTIAL);
+		log->data = (const char*)data;
+	}
+	close(fd);
+	return 1;
+#else
+	FILE* fp = fopen(filename, "rb");
+	if (!fp) return 0;
+	fseek(fp, 0, SEEK_END);
+	log->size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	char* data = (char*)malloc(log->size + 1);
+	if (!data || fread(data, 1, log->size, fp) != log->size) {
+		free(data);
+		fclose(fp);
+		return 0;
+	}
+	fclose(fp);
+	log->data = data;
+	return 1;
+#endif
+}
+
+static void
+close_log(struct log_file* log) {
+#ifndef _WIN32
+	if (log->data) munmap((void*)log->data, log->size);
+#else
+	free((void*)log->data);
+#endif
+}
+
+//the lines in [begin, end) of a log, counted by one thread
+struct count_arg {
+	wordfilterctxptr ctx;
+	struct wf_counter* counter;
+	const char* begin;
+	const char* end;
+	uint64_t lines;
+	int ok;
+};
+
+static void*
+count_lines(void* p) {
+	struct count_arg* arg = (struct count_arg*)p;
+	size_t size = 4096;
+	char* line = (char*)malloc(size);
+	const char* ptr = arg->begin;
+	arg->ok = line != NULL;
+	while (arg->ok && ptr < arg->end) {
+		const char* eol = (const char*)memchr(ptr, '\n', arg->end - ptr);
+		if (!eol) eol = arg->end;
+		size_t len = eol - ptr;
+		if (len + 1 > size) {
+			while (len + 1 > size) size <<= 1;
+			free(line);
+			if (!(line = (char*)malloc(size))) {
+				arg->ok = 0;
+				break;
+			}
+		}
+		memcpy(line, ptr, len);
+		line[len] = '\0';
+		if (wf_count_word(arg->ctx, arg->counter, line, WF_CATEGORY_ALL) < 0) arg->ok = 0;
+		arg->lines++;
+		ptr = eol + 1;
+	}
+	free(line);
+	return NULL;
+}
+
+//split the log at line ends among the threads, every thread counts into a counter of its own
+static int
+count_log(wordfilterctxptr ctx, struct wf_counter** counters, int threads, const struct log_file* log, uint64_t* lines) {
+	struct count_arg args[MAX_THREAD];
+	pthread_t tid[MAX_THREAD];
+	int started[MAX_THREAD];
+	const char* ptr = log->data;
+	const char* end = log->data + log->size;
+	int i, ok = 1;
+	for (i = 0; i < threads; i++) {
+		const char* next = i == threads - 1 ? end : log->data + log->size / threads * (i + 1);
+		if (next < ptr) next = ptr;
+		while (next > log->data && next < end && next[-1] != '\n') next++;
+		args[i] = (struct count_arg){ctx, counters[i], ptr, next, 0, 1};
+		ptr = next;
+	}
+	for (i = 0; i < threads; i++) {
+		started[i] = pthread_create(&tid[i], NULL, count_lines, &args[i]) == 0;
+		if (!started[i]) count_lines(&args[i]);
+	}
+	for (i = 0; i < threads; i++) {
+		if (started[i]) pthread_join(tid[i], NULL);
+		ok = ok && args[i].ok;
+		*lines += args[i].lines;
+	}
+	return ok;
+}
+
+int main(int argc, char **argv) {
+	int ignorecase = 0, utf8 = 0, threads = 1, top = 20, i;
+	const char* skipfile = NULL;
+	const char* equivfile = NULL;
+	const char* allowfile = NULL;
+	const char* wholefile = NULL;
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (strcmp(argv[i], "-i") == 0) ignorecase = 1;
+		else if (strcmp(argv[i], "-u") == 0) utf8 = 1;
+		else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) skipfile = argv[++i];
+		else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) wholefile = argv[++i];
+		else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) allowfile = argv[++i];
+		else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) equivfile = argv[++i];
+		else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) threads = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) top = atoi(argv[++i]);
+		else break;
+	}
+	if (argc - i < 2) {
+		fprintf(stderr, "usage: wf_count [-i] [-u] [-s skipfile] [-w wholefile] [-a allowfile] [-e equivfile] [-j threads] [-n top] wordfile logfile...\n"
+			"  -i  ignore case\n"
+			"  -u  step by utf8 characters\n"
+			"  -s  skip words, one per line\n"
+			"  -w  whole words, one per line\n"
+			"  -a  allowed words, one per line\n"
+			"  -e  equivalence classes, one per line: canonical variants\n"
+			"  -j  count the logs by several threads\n"
+			"  -n  print the top n words(0:all), default 20\n");
+		return 1;
+	}
+	if (threads < 1) threads = 1;
+	if (threads > MAX_THREAD) threads = MAX_THREAD;
+
+	wordfilterctxptr ctx = wf_create_ctx();
+	wf_set_ignore_case(ctx, ignorecase);
+	wf_set_utf8(ctx, utf8);
+	if ((equivfile && !load_equiv(ctx, equivfile))
+		|| !load_words(ctx, argv[i], wf_insert_word)
+		|| (skipfile && !load_words(ctx, skipfile, wf_insert_skip_word))
+		|| (wholefile && !load_words(ctx, wholefile, insert_whole_word))
+		|| (allowfile && !load_words(ctx, allowfile, wf_insert_allow_word))) {
+		wf_free_ctx(ctx);
+		return 1;
+	}
+
+	struct wf_counter* counters[MAX_THREAD];
+	int t, ok = 1;
+	for (t = 0; t < threads; t++)
+		if (!(counters[t] = wf_counter_create())) ok = 0;
+	uint64_t lines = 0;
+	for (i++; ok && i < argc; i++) {
+		struct log_file log;
+		if (!open_log(argv[i], &log)) {
+			fprintf(stderr, "wf_count: can't open %s\n", argv[i]);
+			ok = 0;
+			break;
+		}
+		ok = count_log(ctx, counters, threads, &log, &lines);
+		close_log(&log);
+		if (!ok) fprintf(stderr, "wf_count: %s count error\n", argv[i]);
+	}
+	for (t = 1; ok && t < threads; t++)
+		ok = wf_counter_merge(counters[0], counters[t]);
+
+	if (ok) {
+		uint64_t total;
+		uint32_t num;
+		wf_counter_top(counters[0], NULL, 0, &total, &num);
+		uint32_t n = top > 0 && (uint32_t)top < num ? (uint32_t)top : num;
+		struct wf_word_count* words = (struct wf_word_count*)malloc(sizeof(*words) * (n ? n : 1));
+		if (words) {
+			n = wf_counter_top(counters[0], words, n, NULL, NULL);
+			printf("lines:%llu matches:%llu words:%u\n", (unsigned long long)lines, (unsigned long long)total, num);
+			uint32_t k;
+			for (k = 0; k < n; k++)
+				printf("%llu\t%s\n", (unsigned long long)words[k].count, words[k].word);
+			free(words);
+		} else {
+			ok = 0;
+		}
+	}
+	for (t = 0; t < threads; t++) wf_counter_free(counters[t]);
+	wf_free_ctx(ctx);
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,154 @@
+#include "word_filter.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+//equivalence classes, one per line: canonical character then its variants
+static int
+load_equiv(wordfilterctxptr ctx, const char* filename) {
+	FILE* fp = fopen(filename, "r");
+	if (!fp) {
+		fprintf(stderr, "wf_gen: can't open %s\n", filename);
+		return 0;
+	}
+	char line[1024];
+	int lineno = 0;
+	while (fgets(line, sizeof(line), fp)) {
+		char* canonical = strtok(line, " \t\r\n");
+		char* variants = canonical ? strtok(NULL, " \t\r\n") : NULL;
+		lineno++;
+		if (!canonical) continue;
+		if (!variants || !wf_add_equiv(ctx, canonical, variants)) {
+			fprintf(stderr, "wf_gen: %s:%d add equivalence class error\n", filename, lineno);
+			fclose(fp);
+			return 0;
+		}
+	}
+	fclose(fp);
+	return 1;
+}
+
+static int
+insert_whole_word(wordfilterctxptr ctx, const char* word) {
+	return wf_insert_whole_word(ctx, word, WF_CATEGORY_DEFAULT, 0);
+}
+
+static int
+insert_pattern(wordfilterctxptr ctx, const char* pattern) {
+	return wf_insert_pattern(ctx, pattern, WF_CATEGORY_DEFAULT, 0);
+}
+
+//build a context from a word file(one word per line) and write it as C source
+static int
+load_words(wordfilterctxptr ctx, const char* filename, int (*insert)(wordfilterctxptr, const char*)) {
+	FILE* fp = fopen(filename, "r");
+	if (!fp) {
+		fprintf(stderr, "wf_gen: can't open %s\n", filename);
+		return 0;
+	}
+	char line[1024];
+	int lineno = 0;
+	while (fgets(line, sizeof(line), fp)) {
+		size_t len = strlen(line);
+		lineno++;
+		while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r')) line[--len] = '\0';
+		if (len == 0) continue;
+		if (!insert(ctx, line)) {
+			fprintf(stderr, "wf_gen: %s:%d insert word error[%s]\n", filename, lineno, line);
+			fclose(fp);
+			return 0;
+		}
+	}
+	fclose(fp);
+	return 1;
+}
+
+//the word file built by 'threads' threads
+static int
+load_words_parallel(wordfilterctxptr ctx, const char* filename, int threads) {
+	FILE* fp = fopen(filename, "r");
+	if (!fp) {
+		fprintf(stderr, "wf_gen: can't open %s\n", filename);
+		return 0;
+	}
+	char line[1024];
+	char** words = NULL;
+	size_t num = 0, size = 0, i;
+	int ok = 1;
+	while (ok && fgets(line, sizeof(line), fp)) {
+		size_t len = strlen(line);
+		while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r')) line[--len] = '\0';
+		if (len == 0) continue;
+		if (num == size) {
+			size = size ? size << 1 : 1024;
+			char** newwords = (char**)realloc(words, sizeof(char*) * size);
+			if (!newwords) {
+				ok = 0;
+				break;
+			}
+			words = newwords;
+		}
+		if (!(words[num] = strdup(line))) ok = 0;
+		else num++;
+	}
+	fclose(fp);
+	if (ok && !wf_insert_words(ctx, (const char**)words, num, WF_CATEGORY_DEFAULT, 0, threads)) {
+		fprintf(stderr, "wf_gen: %s insert word error\n", filename);
+		ok = 0;
+	}
+	for (i = 0; i < num; i++) free(words[i]);
+	free(words);
+	return ok;
+}
+
+int main(int argc, char **argv) {
+	int ignorecase = 0, minimize = 0, threads = 1, i;
+	const char* skipfile = NULL;
+	const char* equivfile = NULL;
+	const char* allowfile = NULL;
+	const char* wholefile = NULL;
+	const char* patternfile = NULL;
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (strcmp(argv[i], "-i") == 0) ignorecase = 1;
+		else if (strcmp(argv[i], "-m") == 0) minimize = 1;
+		else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) skipfile = argv[++i];
+		else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) patternfile = argv[++i];
+		else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) wholefile = argv[++i];
+		else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) allowfile = argv[++i];
+		else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) equivfile = argv[++i];
+		else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) threads = atoi(argv[++i]);
+		else break;
+	}
+	if (argc - i != 2) {
+		fprintf(stderr, "usage: wf_gen [-i] [-m] [-s skipfile] [-w wholefile] [-p patternfile] [-a allowfile] [-e equivfile] [-j threads] wordfile name > name.c\n"
+			"  -i  ignore case\n"
+			"  -m  minimize the dictionary(DAWG)\n"
+			"  -s  skip words, one per line\n"
+			"  -p  patterns('?', '{m,n}' gaps), one per line\n"
+			"  -w  whole words, one per line\n"
+			"  -a  allowed words, one per line\n"
+			"  -e  equivalence classes, one per line: canonical variants\n"
+			"  -j  build the word file by several threads\n");
+		return 1;
+	}
+
+	wordfilterctxptr ctx = wf_create_ctx();
+	wf_set_ignore_case(ctx, ignorecase);
+	if ((equivfile && !load_equiv(ctx, equivfile))
+		|| !(threads > 1 ? load_words_parallel(ctx, argv[i], threads) : load_words(ctx, argv[i], wf_insert_word))
+		|| (skipfile && !load_words(ctx, skipfile, wf_insert_skip_word))
+		|| (patternfile && !load_words(ctx, patternfile, insert_pattern))
+		|| (wholefile && !load_words(ctx, wholefile, insert_whole_word))
+		|| (allowfile && !load_words(ctx, allowfile, wf_insert_allow_word))) {
+		wf_free_ctx(ctx);
+		return 1;
+	}
+	if (minimize)
+		wf_minimize(ctx);
+	else
+		wf_compact(ctx);
+
+	int ok = wf_dump_static(ctx, argv[i+1], stdout);
+	wf_free_ctx(ctx);
+	return ok ? 0 : 1;
+}
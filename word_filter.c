@@ -21,19 +21,26 @@
 //License:MIT
 
 #include "word_filter.h"
+#include "word_filter_node.h"
 #define _CRT_SECURE_NO_WARNINGS
+#include <pthread.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+#include <sched.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <semaphore.h>
+#endif
 
 #define MAX_TRIE_SIZE 0xFF
-#define MAX_WORD_LENGTH 0xFF //word length limit
-#define MAX_INDEX 0xFFFFF
-
-#define twoto(x) (1<<(x))
-static uint32_t
-ceil_log2(uint32_t x) {
-	int i = 0;
-	while (x) {x=x>>1; ++i;}
-	return i;
-}
+#define MAX_WORD_LENGTH WF_MAX_WORD_LENGTH //word length limit
+#define MAX_GAP_LENGTH 8
+#define MAX_GAP_NUM 8 //gaps in one pattern
 
 inline static int
 get_utf8_size(char c) {
@@ -42,44 +49,53 @@ get_utf8_size(char c) {
 	return n ? n : 1;
 }
 
-#define trie_get_data(n)               ( (n)->data & 0xFF )
-#define trie_get_isword(n)             ( ((n)->data & 0x100) >> 8 )
-#define trie_get_capacity_pool(n)      ( (((n)->data & 0xE00) >> 9))
-#define trie_get_capacity(n)           ( twoto(trie_get_capacity_pool(n)+1) - 1 )
-#define trie_get_children_index(n)     ( ((n)->data & 0xFFFFF000) >> 12 )
-#define trie_get_children(pool, node)  pool_get_trie((pool), trie_get_capacity_pool(node), trie_get_children_index(node))
 
-#define trie_set_data(n, v)            ( (n)->data = ((n)->data & 0xFFFFFF00) | ((v) & 0xFF) )
-#define trie_set_isword(n, v)          ( (n)->data = ((n)->data & 0xFFFFFEFF) | (((v) & 0x1) << 8) )
-#define trie_set_rawcapacity(n, v)     ( (n)->data = ((n)->data & 0xFFFFF1FF) | (((v) & 0x7) << 9) )
-#define trie_set_capacity(n, v)        trie_set_rawcapacity( n, ceil_log2((v))-1 ) /*v:1~255*/
-#define trie_set_children_index(n, v)  ( (n)->data = ((n)->data & 0x00000FFF) | (((v) & 0xFFFFF) << 12) )
 
-#define get_pool_unit_size(pool_index) ( sizeof(struct _trie)*(twoto(pool_index+1)-1) )/*pool_index:0~7*/
+//the memory counter is sharded by thread, the threads searching at the same time don't write one cache line
+#define MEM_SHARDS 64
+static struct {
+	size_t size;
+	char pad[64 - sizeof(size_t)];
+} g_memsize[MEM_SHARDS];
+static uint32_t g_mem_thread = 0;
+static __thread int t_mem_shard = -1;
+static uint64_t g_generation = 0;
 
+//every change of a context gets a new generation, so the results cached for it go stale
+#define touch_ctx(ctx) ( (ctx)->generation = __sync_add_and_fetch(&g_generation, 1) )
 
-static size_t g_memsize = 0;
+static inline size_t*
+mem_shard() {
+	if (t_mem_shard < 0)
+		t_mem_shard = __sync_fetch_and_add(&g_mem_thread, 1) % MEM_SHARDS;
+	return &g_memsize[t_mem_shard].size;
+}
 
+//a shard may wrap below 0 when memory is freed by another thread, the sum is right
 inline size_t wf_get_memsize() {
-	return g_memsize;
+	size_t size = 0;
+	int i;
+	for (i=0; i<MEM_SHARDS; i++)
+		size += __atomic_load_n(&g_memsize[i].size, __ATOMIC_RELAXED);
+	return size;
 }
 
+//atomic, the contexts may be built by several threads(wf_insert_words)
 void*
 wf_malloc(size_t size) {
-	g_memsize += size;
+	__atomic_add_fetch(mem_shard(), size, __ATOMIC_RELAXED);
 	return malloc(size);
 }
 
 void
 wf_free(void* p, size_t size) {
-	g_memsize -= size;
+	__atomic_sub_fetch(mem_shard(), size, __ATOMIC_RELAXED);
 	free(p);
 }
 
 void*
 wf_realloc(void* p, size_t newsize, size_t oldsize) {
-	g_memsize += newsize;
-	g_memsize -= oldsize;
+	__atomic_add_fetch(mem_shard(), newsize - oldsize, __ATOMIC_RELAXED);
 	return realloc(p, newsize);
 }
 
@@ -100,6 +116,215 @@ wf_tolower(char c) {
 	return (c >= 'A' && c <= 'Z') ? (c + 32) : c;
 }
 
+#define UTF8_INVALID 0x80000000 //an invalid byte is kept as it is
+
+static inline int
+utf8_decode(const char* str, uint32_t* cp) {
+	byte c = str[0];
+	if (c < 0x80) {
+		*cp = c;
+		return 1;
+	}
+	int n = c >= 0xF8 ? 0 : c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 0;
+	if (n == 0) {
+		*cp = UTF8_INVALID | c;
+		return 1;
+	}
+	uint32_t v = c & (0x3F >> (n-1));
+	int i;
+	for (i=1; i<n; i++) {
+		byte b = str[i];
+		if ((b & 0xC0) != 0x80) break;
+		v = (v << 6) | (b & 0x3F);
+	}
+	if (i < n) {
+		*cp = UTF8_INVALID | c;
+		return 1;
+	}
+	*cp = v;
+	return n;
+}
+
+//the size of a character by its lead byte, for the valid utf8 text
+static const byte utf8_size_table[16] = {1,1,1,1,1,1,1,1, 1,1,1,1, 2,2,3,4};
+
+/*
+ * the length of the valid utf8 prefix of 'str'(the sequences utf8_decode accepts), ascii is checked 8 bytes at a time.
+ * the scans use it once per text to step by characters, see wf_set_utf8.
+ */
+size_t
+wf_utf8_valid(const char* str, size_t len) {
+	size_t i = 0;
+	while (i < len) {
+		uint64_t v;
+		if (i + 8 <= len) {
+			memcpy(&v, str + i, 8);
+			if (!(v & 0x8080808080808080ULL)) {
+				i += 8;
+				continue;
+			}
+		}
+		byte c = str[i];
+		if (c < 0x80) {
+			i++;
+			continue;
+		}
+		if (c < 0xC0 || c >= 0xF8) return i;
+		size_t n = utf8_size_table[c >> 4], j;
+		if (i + n > len) return i;
+		for (j=1; j<n; j++)
+			if (((byte)str[i+j] & 0xC0) != 0x80) return i;
+		i += n;
+	}
+	return len;
+}
+
+//the bytes to the next scan position, whole characters before 'valid_end', else one byte
+static inline int
+scan_step(const char* wordptr, const char* valid_end) {
+	return wordptr < valid_end ? utf8_size_table[(byte)*wordptr >> 4] : 1;
+}
+
+static inline const char*
+scan_valid_end(wordfilterctxptr ctx, const char* word) {
+	return ctx->utf8 ? word + wf_utf8_valid(word, strlen(word)) : word;
+}
+
+static inline int
+utf8_encode(uint32_t cp, byte* buf) {
+	if (cp & UTF8_INVALID) {buf[0] = cp & 0xFF; return 1;}
+	if (cp < 0x80) {buf[0] = cp; return 1;}
+	if (cp < 0x800) {buf[0] = 0xC0 | (cp >> 6); buf[1] = 0x80 | (cp & 0x3F); return 2;}
+	if (cp < 0x10000) {buf[0] = 0xE0 | (cp >> 12); buf[1] = 0x80 | ((cp >> 6) & 0x3F); buf[2] = 0x80 | (cp & 0x3F); return 3;}
+	buf[0] = 0xF0 | (cp >> 18); buf[1] = 0x80 | ((cp >> 12) & 0x3F); buf[2] = 0x80 | ((cp >> 6) & 0x3F); buf[3] = 0x80 | (cp & 0x3F);
+	return 4;
+}
+
+//ascii letters,digits,'_' and the latin,greek,cyrillic letters
+static inline int
+is_word_char(uint32_t cp) {
+	if (cp < 0x80) return (cp >= '0' && cp <= '9') || ((cp | 0x20) >= 'a' && (cp | 0x20) <= 'z') || cp == '_';
+	if (cp & UTF8_INVALID) return 0;
+	return (cp >= 0xC0 && cp <= 0x24F && cp != 0xD7 && cp != 0xF7) || (cp >= 0x370 && cp <= 0x52F);
+}
+
+//is the character before 'str' not a word character
+static inline int
+boundary_before(const char* begin, const char* str) {
+	if (str == begin) return 1;
+	const char* p = str - 1;
+	while (p > begin && str - p < 4 && ((byte)*p & 0xC0) == 0x80) p--;
+	uint32_t cp;
+	return p + utf8_decode(p, &cp) != str || !is_word_char(cp);
+}
+
+static inline int
+boundary_after(const char* str) {
+	uint32_t cp;
+	if (!*str) return 1;
+	utf8_decode(str, &cp);
+	return !is_word_char(cp);
+}
+
+//variant code point -> canonical code point
+struct _equiv_map {
+	uint32_t ascii[0x80];
+	uint32_t num;
+	uint32_t size;
+	uint32_t* pair; //sorted (variant, canonical) pairs of the non ascii variants
+};
+
+static inline uint32_t
+equiv_lookup(struct _equiv_map* equiv, uint32_t cp) {
+	if (cp < 0x80) return equiv->ascii[cp];
+	int l = 0, r = (int)equiv->num - 1;
+	while (l <= r) {
+		int middle = (l + r) >> 1;
+		uint32_t variant = equiv->pair[middle << 1];
+		if (variant == cp) return equiv->pair[(middle << 1) + 1];
+		if (variant < cp) l = middle + 1;
+		else r = middle - 1;
+	}
+	return cp;
+}
+
+static struct _equiv_map*
+equiv_create() {
+	struct _equiv_map* equiv = (struct _equiv_map*)wf_malloc(sizeof(*equiv));
+	if (!equiv) return NULL;
+	memset(equiv, 0, sizeof(*equiv));
+	uint32_t i;
+	for (i=0; i<0x80; i++) equiv->ascii[i] = i;
+	return equiv;
+}
+
+static void
+equiv_free(struct _equiv_map* equiv) {
+	if (!equiv) return;
+	if (equiv->pair) wf_free(equiv->pair, sizeof(uint32_t) * 2 * equiv->size);
+	wf_free(equiv, sizeof(*equiv));
+}
+
+static int
+equiv_set(struct _equiv_map* equiv, uint32_t variant, uint32_t canonical) {
+	if (variant < 0x80) {
+		equiv->ascii[variant] = canonical;
+		return 1;
+	}
+	uint32_t i = 0;
+	while (i < equiv->num && equiv->pair[i << 1] < variant) i++;
+	if (i < equiv->num && equiv->pair[i << 1] == variant) {
+		equiv->pair[(i << 1) + 1] = canonical;
+		return 1;
+	}
+	if (equiv->num == equiv->size) {
+		uint32_t newsize = equiv->size ? equiv->size << 1 : 16;
+		uint32_t* pair = (uint32_t*)wf_realloc(equiv->pair, sizeof(uint32_t) * 2 * newsize, sizeof(uint32_t) * 2 * equiv->size);
+		if (!pair) return 0;
+		equiv->pair = pair;
+		equiv->size = newsize;
+	}
+	memmove(&equiv->pair[(i + 1) << 1], &equiv->pair[i << 1], sizeof(uint32_t) * 2 * (equiv->num - i));
+	equiv->pair[i << 1] = variant;
+	equiv->pair[(i << 1) + 1] = canonical;
+	equiv->num++;
+	return 1;
+}
+
+static struct _equiv_map*
+equiv_clone(struct _equiv_map* equiv) {
+	if (!equiv) return NULL;
+	struct _equiv_map* newequiv = (struct _equiv_map*)wf_malloc(sizeof(*newequiv));
+	if (!newequiv) return NULL;
+	*newequiv = *equiv;
+	if (equiv->size) {
+		newequiv->pair = (uint32_t*)wf_malloc(sizeof(uint32_t) * 2 * equiv->size);
+		if (!newequiv->pair) {
+			wf_free(newequiv, sizeof(*newequiv));
+			return NULL;
+		}
+		memcpy(newequiv->pair, equiv->pair, sizeof(uint32_t) * 2 * equiv->size);
+	}
+	return newequiv;
+}
+
+//the canonical bytes of the character at 'str', return its length in 'str'
+static inline int
+read_char(wordfilterctxptr ctx, const char* str, byte* buf, int* len) {
+	if (!ctx->equiv) {
+		buf[0] = ctx->ignorecase ? wf_tolower(*str) : *str;
+		*len = 1;
+		return 1;
+	}
+	uint32_t cp;
+	int n = utf8_decode(str, &cp);
+	if (ctx->ignorecase && cp < 0x80) cp = wf_tolower(cp);
+	cp = equiv_lookup(ctx->equiv, cp);
+	if (ctx->ignorecase && cp < 0x80) cp = wf_tolower(cp);
+	*len = utf8_encode(cp, buf);
+	return n;
+}
+
 static inline char*
 copy_string(const char* str) {
 	size_t str_len = strlen(str);
@@ -141,13 +366,43 @@ pool_deinit(struct _trie_pool pool[8]) {
 	}
 }
 
+//pools are index-addressed, so a copy is a bulk copy of each pool plus its freelist
+static int
+pool_clone(struct _trie_pool dst[8], struct _trie_pool src[8]) {
+	int i;
+	memset(dst, 0, sizeof(struct _trie_pool) * 8);
+	for (i=0; i<8; i++) {
+		dst[i].pool_size = src[i].pool_size;
+		dst[i].pool_tail = src[i].pool_tail;
+		if (src[i].pool) {
+			size_t size = src[i].pool_size * get_pool_unit_size(i);
+			dst[i].pool = (trieptr)wf_malloc(size);
+			if (!dst[i].pool) return 0;
+			memcpy(dst[i].pool, src[i].pool, size);
+		}
+
+		struct _trie_pool_free_node** tail = &dst[i].freelist;
+		struct _trie_pool_free_node* freenode = src[i].freelist;
+		while (freenode) {
+			struct _trie_pool_free_node* newnode = (struct _trie_pool_free_node*)wf_malloc(sizeof(*newnode));
+			if (!newnode) return 0;
+			newnode->index = freenode->index;
+			newnode->next = NULL;
+			*tail = newnode;
+			tail = &newnode->next;
+			freenode = freenode->next;
+		}
+	}
+	return 1;
+}
+
 //return user index(>0)
 static uint32_t
 pool_alloc(struct _trie_pool pool[8], uint32_t pool_index) {
 	static uint32_t pool_enlarge_size[8] = {8,4,2,1,1,1,1,1};
 	struct _trie_pool* mypool = &pool[pool_index];
 
-	assert(mypool->pool_tail <= MAX_INDEX);
+	if (mypool->pool_tail >= MAX_INDEX && !mypool->freelist) return 0; //the children index is 20 bits
 
 	//先检测freelist是否有空闲空间，否则才用pool尾部的空闲空间，如果pool尾部也没有空间了，才扩充pool_size
 	if (mypool->freelist) {
@@ -185,21 +440,32 @@ pool_free(struct _trie_pool pool[8], uint32_t pool_index, uint32_t free_index) {
 	mypool->freelist = freenode;
 }
 
-static inline trieptr
-pool_get_trie(struct _trie_pool pool[8], uint32_t pool_index, uint32_t index) {
-	struct _trie_pool* mypool = &pool[pool_index];
-	if (mypool->pool == NULL || index == 0) return NULL;
-	index--;
-	return &mypool->pool[index * (twoto(pool_index+1)-1)];
+//a word inserted again:categories are merged, the highest severity is kept,
+//the last insert of a banned word decides if it is a whole word(allowing a word doesn't change it)
+static inline uint32_t
+merge_value(uint32_t old, uint32_t value) {
+	uint32_t severity = value_get_severity(value);
+	if (severity < value_get_severity(old)) severity = value_get_severity(old);
+	uint32_t flag = (old | value) & 0x0F000000;
+	if (!(value & WORD_FLAG_ALLOW))
+		flag = (flag & ~WORD_FLAG_WHOLE) | (value & WORD_FLAG_WHOLE);
+	return trie_make_value(value_get_category(old) | value_get_category(value), severity) | flag;
+}
+
+static inline void
+trie_merge_value(trieptr node, uint32_t value) {
+	trie_set_payload(node, merge_value(node->value, value));
 }
 
 static inline strnodeptr
-insert_str(strnodeptr strnode, const char* str) {
+insert_str(strnodeptr strnode, const char* str, uint32_t value) {
 	if (strnode) {
 		strnodeptr newstrnode = (strnodeptr)wf_malloc(sizeof(*strnode));
 		if (!newstrnode) return NULL;
 		memset(newstrnode, 0, sizeof(*newstrnode));
 		newstrnode->str = copy_string(str);
+		newstrnode->category = value_get_category(value);
+		newstrnode->severity = value_get_severity(value);
 		newstrnode->next = strnode;
 		return newstrnode;
 	}
@@ -207,6 +473,8 @@ insert_str(strnodeptr strnode, const char* str) {
 	if (!strnode) return NULL;
 	memset(strnode, 0, sizeof(*strnode));
 	strnode->str = copy_string(str);
+	strnode->category = value_get_category(value);
+	strnode->severity = value_get_severity(value);
 	return strnode;
 }
 
@@ -253,6 +521,7 @@ reserve(wordfilterctxptr ctx, trieptr* node, struct _trie_node_index node_index)
 
 		children = trie_get_children(ctx->pool, *node);
 		children[0].data = 0;
+		children[0].value = 0;
 		return 1;
 	}
 	
@@ -277,6 +546,7 @@ reserve(wordfilterctxptr ctx, trieptr* node, struct _trie_node_index node_index)
 		}
 		for (i=oldcapacity; i<newcapacity; i++) {
 			newchildren[i].data = 0;
+			newchildren[i].value = 0;
 		}
 
 		pool_free(ctx->pool, oldclildren_index.pool_index, oldclildren_index.index);
@@ -285,7 +555,7 @@ reserve(wordfilterctxptr ctx, trieptr* node, struct _trie_node_index node_index)
 }
 
 static trieptr
-add_trie(wordfilterctxptr ctx, trieptr* node, byte index, byte c, byte isword, struct _trie_node_index node_index) {
+add_trie(wordfilterctxptr ctx, trieptr* node, byte index, byte c, byte isword, uint32_t value, struct _trie_node_index node_index) {
 	if (!reserve(ctx, node, node_index)) return NULL;
 
 	trieptr children = trie_get_children(ctx->pool, *node);
@@ -304,6 +574,7 @@ add_trie(wordfilterctxptr ctx, trieptr* node, byte index, byte c, byte isword, s
 	memset(newnode, 0, sizeof(*newnode));
 	trie_set_data(newnode, c);
 	trie_set_isword(newnode, isword);
+	if (isword) newnode->value = value;
 	//trie_set_children_index(newnode, 0);
 	return newnode;
 }
@@ -336,28 +607,163 @@ binary_search(wordfilterctxptr ctx, trieptr node, byte c, int* exist) {
 	return l;
 }
 
+//one transition from 'node', '*pos' is the position inside a chain
+static inline trieptr
+trie_step(struct _trie_pool pool[8], trieptr node, int* pos, byte c) {
+	trieptr children = trie_get_children(pool, node);
+	if (!children) return NULL;
+
+	if (trie_get_chain(node)) {
+		const byte* label = trie_get_chain_label(children);
+		if (*pos < label[0]) {
+			if (label[*pos + 1] != c) return NULL;
+			(*pos)++;
+			return node;
+		}
+		if (trie_get_data(children) != c) return NULL;
+		*pos = 0;
+		return children;
+	}
+
+	byte capacity = trie_get_capacity(node);
+	int l = 0, r = capacity - 1;
+	while (l <= r) {
+		int middle = (l + r) >> 1;
+		byte data = trie_get_data(&children[middle]);
+		if (data == 0 || data > c) {
+			r = middle - 1;
+		}
+		else if (data == c) {
+			return &children[middle];
+		}
+		else {
+			l = middle + 1;
+		}
+	}
+	return NULL;
+}
+
+static inline trieptr
+get_node_by_index(wordfilterctxptr ctx, trieptr root, struct _trie_node_index node_index) {
+	if (!node_index.index) return root;
+	return pool_get_trie(ctx->pool, node_index.pool_index, node_index.index) + node_index.children_index;
+}
+
+//make 'node' a chain over 'path'(len>=2), the last byte becomes a real node
+static trieptr
+make_chain(wordfilterctxptr ctx, trieptr root, struct _trie_node_index node_index, const byte* path, int len) {
+	int label_len = len - 1;
+	uint32_t block_size = get_chain_block_size(label_len);
+	uint32_t pool_index = ceil_log2(block_size) - 1;
+	uint32_t index = pool_alloc(ctx->pool, pool_index);
+	if (!index) return NULL;
+
+	trieptr node = get_node_by_index(ctx, root, node_index);
+	trie_set_capacity(node, block_size);
+	trie_set_children_index(node, index);
+	trie_set_chain(node, 1);
+
+	trieptr children = trie_get_children(ctx->pool, node);
+	memset(children, 0, get_pool_unit_size(pool_index));
+	trie_set_data(children, path[label_len]);
+	byte* label = trie_get_chain_label(children);
+	label[0] = label_len;
+	memcpy(label + 1, path, label_len);
+	return children;
+}
+
+/*
+ * split a chain so that the byte at 'split'(1~label length) becomes a real node,
+ * the chain before it stays on 'node', the rest moves to the new node.
+ */
+static int
+split_chain(wordfilterctxptr ctx, trieptr root, struct _trie_node_index node_index, int split) {
+	trieptr node = get_node_by_index(ctx, root, node_index);
+	struct _trie_node_index old_index = { trie_get_capacity_pool(node), trie_get_children_index(node), 0 };
+	trieptr children = trie_get_children(ctx->pool, node);
+	byte path[MAX_CHAIN_LENGTH + 1];
+	struct _trie end = children[0];
+	byte* label = trie_get_chain_label(children);
+	int len = label[0];
+	assert(split >= 1 && split <= len);
+	memcpy(path, label + 1, len);
+	path[len] = trie_get_data(&end);
+	len++;
+
+	//the node before the split point
+	if (split == 1) {
+		uint32_t index = pool_alloc(ctx->pool, 0);
+		if (!index) return 0;
+		node = get_node_by_index(ctx, root, node_index);
+		trie_set_capacity(node, 1);
+		trie_set_children_index(node, index);
+		trie_set_chain(node, 0);
+		children = trie_get_children(ctx->pool, node);
+		memset(children, 0, sizeof(*children));
+		trie_set_data(children, path[0]);
+	} else {
+		children = make_chain(ctx, root, node_index, path, split);
+		if (!children) return 0;
+	}
+
+	//the split node takes over the rest
+	node = get_node_by_index(ctx, root, node_index);
+	struct _trie_node_index split_index = { trie_get_capacity_pool(node), trie_get_children_index(node), 0 };
+	if (len - split == 1) {
+		uint32_t index = pool_alloc(ctx->pool, 0);
+		if (!index) return 0;
+		trieptr split_node = get_node_by_index(ctx, root, split_index);
+		trie_set_capacity(split_node, 1);
+		trie_set_children_index(split_node, index);
+		children = trie_get_children(ctx->pool, split_node);
+	} else {
+		children = make_chain(ctx, root, split_index, path + split, len - split);
+		if (!children) return 0;
+	}
+	children[0] = end;
+
+	pool_free(ctx->pool, old_index.pool_index, old_index.index);
+	return 1;
+}
+
+static inline void
+set_word(trieptr node, uint32_t value) {
+	if (trie_get_isword(node))
+		trie_merge_value(node, value);
+	else
+		trie_set_payload(node, value);
+	trie_set_isword(node, 1);
+}
+
 static inline int
-skip_word(wordfilterctxptr ctx, trieptr word_root, const char** str, int ignorecase) {
+skip_word(wordfilterctxptr ctx, struct _trie_pool pool[8], trieptr word_root, const char** str) {
 	if (!str) return 0;
-	char c;
 	const char* wordptr = *str;
 	trieptr node = word_root;
+	int pos = 0;
 	int pos_index = 0;
 	int find_pos = 0;
-	while ((c = *wordptr)) {
-		if (ignorecase) c = wf_tolower(c);
-		int exist = 0;
-		byte index = binary_search(ctx, node, c, &exist);
-		if (!exist) break;
-
-		pos_index++;
-		trieptr children = trie_get_children(ctx->pool, node);
-		node = &children[index];
+	byte buf[4];
+	int len, n, i;
+	int ignorecase = ctx->ignorecase;
+	while (*wordptr) {
+		if (!ctx->equiv) {
+			//one byte a step
+			char c = ignorecase ? wf_tolower(*wordptr) : *wordptr;
+			n = 1;
+			node = trie_step(pool, node, &pos, c);
+		} else {
+			n = read_char(ctx, wordptr, buf, &len);
+			for (i=0; i<len && node; i++)
+				node = trie_step(pool, node, &pos, buf[i]);
+		}
+		if (!node) break;
 
-		if (trie_get_isword(node)) {
+		pos_index += n;
+		if (pos == 0 && trie_get_isword(node)) {
 			find_pos = pos_index;
 		}
-		wordptr++;
+		wordptr += n;
 	}
 
 	if (find_pos)
@@ -366,212 +772,3146 @@ skip_word(wordfilterctxptr ctx, trieptr word_root, const char** str, int ignorec
 	return find_pos;
 }
 
-static int
-do_insert_word(wordfilterctxptr ctx, trieptr root, const char* word) {
-	if (strlen(word) > MAX_WORD_LENGTH) return 0;
-
-	const char* wordptr = word;
-	char c;
-	trieptr node = root;
-	struct _trie_node_index node_index = {0,0,0};
-	while ((c = *wordptr)) {
-		if (ctx->ignorecase) c = wf_tolower(c);
-		int exist = 0;
-		byte index = binary_search(ctx, node, c, &exist);
-		byte isword = *(wordptr + 1) == '\0';
-		if (exist) {
-			trieptr children = trie_get_children(ctx->pool, node);
-			node_index = (struct _trie_node_index){trie_get_capacity_pool(node), trie_get_children_index(node), index};
-			node = &children[index];
-			if (isword) {
-				trie_set_isword(node, 1);
-			}
-		} else {
-			trieptr newnode = add_trie(ctx, &node, index, c, isword, node_index);
-			if (!newnode) return 0;
-			node_index = (struct _trie_node_index){trie_get_capacity_pool(node), trie_get_children_index(node), index};
-			node = newnode;
+//the longest skip word of the context and its overlay
+static inline int
+search_skip_word(wordfilterctxptr ctx, const char** str) {
+	int skip = skip_word(ctx, ctx->pool, &ctx->skip_word_root, str);
+	if (ctx->overlay) {
+		const char* wordptr = *str - skip;
+		int overlay_skip = skip_word(ctx, ctx->overlay->pool, &ctx->overlay->skip_word_root, &wordptr);
+		if (overlay_skip > skip) {
+			*str = wordptr;
+			skip = overlay_skip;
 		}
-		wordptr++;
 	}
-	return 1;
+	return skip;
 }
 
-static int
-do_search_word(wordfilterctxptr ctx, trieptr word_root, trieptr skip_word_root, const char* word, char* word_key) {
-	char c;
-	int ignorecase = ctx->ignorecase;
-	int find = 0;
-	int word_key_index = 0;
-	trieptr node = word_root;
-	const char* wordptr = word;
-	int skip_num = 0;
-	int exist = 0;
-	byte index = 0;
+/*
+ * q-gram prefilter:the first 1~3 canonical bytes of every word(up to a gap) are hashed into a bitmap,
+ * a word can only start where the bytes of the text hit it. skip words may come between the bytes,
+ * so a position where one begins is always tried.
+ */
+#define QGRAM_BITS 16
+#define qgram_hash(v) ( ((uint32_t)(v) * 2654435761u) >> (32 - QGRAM_BITS) )
+
+struct _qgram {
+	uint32_t skip[8];  //the first bytes of the skip words
+	uint32_t lens;     //bit q-1:some word has a q bytes prefix
+	uint32_t bitmap[twoto(QGRAM_BITS - 5)];
+};
+
+static struct _qgram*
+qgram_create() {
+	struct _qgram* qgram = (struct _qgram*)wf_malloc(sizeof(*qgram));
+	if (qgram) memset(qgram, 0, sizeof(*qgram));
+	return qgram;
+}
 
-	while ((c = *wordptr)) {
-		if (ignorecase) c = wf_tolower(c);
-		exist = 0;
-		index = binary_search(ctx, node, c, &exist);
-		if (!exist) {
-			//word not existed, try skip word
-			int skip = skip_word(ctx, skip_word_root, &wordptr, ignorecase);
-			if (!skip) break;
-			skip_num += skip;
-			continue;
-		}
-		if (word_key) word_key[word_key_index] = *wordptr;
+static void
+qgram_free(struct _qgram* qgram) {
+	if (qgram) wf_free(qgram, sizeof(*qgram));
+}
 
-		word_key_index++;
-		trieptr children = trie_get_children(ctx->pool, node);
-		node = &children[index];
+static struct _qgram*
+qgram_clone(struct _qgram* qgram) {
+	if (!qgram) return NULL;
+	struct _qgram* newqgram = (struct _qgram*)wf_malloc(sizeof(*newqgram));
+	if (newqgram) *newqgram = *qgram;
+	return newqgram;
+}
 
-		if (trie_get_isword(node)) find = word_key_index;
+//'v' holds the 'q' bytes from the high byte
+static inline void
+qgram_add(struct _qgram* qgram, uint32_t v, int q) {
+	uint32_t h = qgram_hash(v);
+	qgram->bitmap[h >> 5] |= 1u << (h & 31);
+	qgram->lens |= 1u << (q - 1);
+}
 
-		wordptr++;
-	}
-	if(word_key) word_key[find] = 0;
-	return find ? (find + skip_num) : 0;
+static inline void
+qgram_add_key(struct _qgram* qgram, const byte* key, int len) {
+	uint32_t v = 0;
+	int q;
+	for (q=0; q<3 && q<len && key[q] != GAP_MARK; q++)
+		v |= (uint32_t)key[q] << (16 - 8*q);
+	if (q) qgram_add(qgram, v, q);
 }
 
-int
-wf_word_isempty(wordfilterctxptr ctx) {
-	if (!ctx) return 1;
-	trieptr children = trie_get_children(ctx->pool, &ctx->word_root);
-	return children == NULL || trie_get_data(children) == 0;
+//add the prefixes of the words below 'node', 'v' holds the 'q' bytes of the path
+static void
+qgram_collect(struct _qgram* qgram, struct _trie_pool pool[8], trieptr node, uint32_t v, int q) {
+	if (q == 3) {
+		qgram_add(qgram, v, q);
+		return;
+	}
+	if (q && trie_get_isword(node)) qgram_add(qgram, v, q);
+	trieptr children = trie_get_children(pool, node);
+	if (!children) return;
+	int i;
+	if (trie_get_chain(node)) {
+		const byte* label = trie_get_chain_label(children);
+		for (i=1; i<=label[0] && q<3; i++)
+			v |= (uint32_t)label[i] << (16 - 8*q++);
+		if (q == 3) qgram_add(qgram, v, q);
+		else qgram_collect(qgram, pool, children, v | (uint32_t)trie_get_data(children) << (16 - 8*q), q + 1);
+		return;
+	}
+	byte capacity = trie_get_capacity(node);
+	for (i=0; i<capacity && trie_get_data(&children[i]); i++) {
+		byte c = trie_get_data(&children[i]);
+		if (c == GAP_MARK) qgram_add(qgram, v, q);
+		else qgram_collect(qgram, pool, &children[i], v | (uint32_t)c << (16 - 8*q), q + 1);
+	}
 }
 
-int
-wf_skipword_isempty(wordfilterctxptr ctx) {
-	if (!ctx) return 1;
+//for the tries that were not built by inserting(wf_open_static)
+static struct _qgram*
+qgram_build(wordfilterctxptr ctx) {
+	struct _qgram* qgram = qgram_create();
+	if (!qgram) return NULL;
+	qgram_collect(qgram, ctx->pool, &ctx->word_root, 0, 0);
 	trieptr children = trie_get_children(ctx->pool, &ctx->skip_word_root);
-	return children == NULL || trie_get_data(children) == 0;
+	byte capacity = trie_get_capacity(&ctx->skip_word_root);
+	int i;
+	for (i=0; children && i<capacity && trie_get_data(&children[i]); i++) {
+		byte c = trie_get_data(&children[i]);
+		qgram->skip[c >> 5] |= 1u << (c & 31);
+	}
+	return qgram;
 }
 
-int
-wf_insert_word(wordfilterctxptr ctx, const char* word) {
-	return do_insert_word(ctx, &ctx->word_root, word);
+//can a word start at 'str', NULL(no memory) tries every position
+static inline int
+qgram_hit(wordfilterctxptr ctx, struct _qgram* qgram, const char* str) {
+	if (!qgram) return 1;
+	uint32_t v = 0;
+	int q = 0;
+	byte buf[4];
+	int len, i;
+	while (*str) {
+		str += read_char(ctx, str, buf, &len);
+		if (qgram->skip[buf[0] >> 5] & (1u << (buf[0] & 31))) return 1;
+		for (i=0; i<len && q<3; i++) {
+			v |= (uint32_t)buf[i] << (16 - 8*q++);
+			if (qgram->lens & (1u << (q - 1))) {
+				uint32_t h = qgram_hash(v);
+				if (qgram->bitmap[h >> 5] & (1u << (h & 31))) return 1;
+			}
+		}
+		if (q == 3) break;
+	}
+	return 0;
 }
 
-int
-wf_insert_skip_word(wordfilterctxptr ctx, const char* word) {
-	return do_insert_word(ctx, &ctx->skip_word_root, word);
+static inline int
+may_match(wordfilterctxptr ctx, const char* str) {
+	return qgram_hit(ctx, ctx->qgram, str) || (ctx->overlay && qgram_hit(ctx, ctx->overlay->qgram, str));
 }
 
-wordfilterctxptr
-wf_create_ctx() {
-	wordfilterctxptr ctx = (wordfilterctxptr)wf_malloc(sizeof(*ctx));
-	if (!ctx) return NULL;
-
-	memset(ctx, 0, sizeof(*ctx));
-	pool_init(ctx->pool);
-
-	ctx->mask_word = '*';
-	return ctx;
+/*
+ * code point mode:the words are keyed by canonical code points instead of bytes, a CJK character is one
+ * transition instead of three. the nodes are an array(node[0] is the root), the children of all nodes
+ * are one hash table of (parent, code point) -> child. skip words stay in the byte trie.
+ */
+#define WIDE_INVALID 0x110000 //+byte, an invalid utf8 byte
+
+struct _wide_edge {
+	uint32_t parent;
+	uint32_t cp;
+	uint32_t child; //0:empty slot
+};
+
+struct _wide_trie {
+	struct _trie* node; //data:isword, value:payload
+	uint32_t node_num;
+	uint32_t node_size;
+	struct _wide_edge* edge;
+	uint32_t edge_num;
+	uint32_t edge_size;
+};
+
+//the slot of an edge, any table size(multiply-shift)
+#define wide_slot(parent, cp, size) ( (uint32_t)(((uint64_t)(((parent) * 0x9E3779B1u) ^ ((cp) * 0x85EBCA77u)) * (size)) >> 32) )
+
+//the canonical code point of the character at 'str', 'n' gets its length in 'str'
+static inline uint32_t
+read_cp(wordfilterctxptr ctx, const char* str, int* n) {
+	uint32_t cp;
+	*n = utf8_decode(str, &cp);
+	if (cp & UTF8_INVALID) return WIDE_INVALID + (cp & 0xFF);
+	if (ctx->ignorecase && cp < 0x80) cp = wf_tolower(cp);
+	if (ctx->equiv) {
+		cp = equiv_lookup(ctx->equiv, cp);
+		if (ctx->ignorecase && cp < 0x80) cp = wf_tolower(cp);
+	}
+	return cp;
 }
 
-void
-wf_clean_ctx(wordfilterctxptr ctx) {
-	if (!ctx) return;
-	pool_deinit(ctx->pool);
-
-	memset(ctx, 0, sizeof(*ctx));
-	pool_init(ctx->pool);
-	ctx->mask_word = '*';
+static struct _wide_trie*
+wide_create() {
+	struct _wide_trie* wide = (struct _wide_trie*)wf_malloc(sizeof(*wide));
+	if (!wide) return NULL;
+	memset(wide, 0, sizeof(*wide));
+	wide->node_size = 16;
+	wide->edge_size = 16;
+	wide->node = (struct _trie*)wf_malloc(sizeof(struct _trie) * wide->node_size);
+	wide->edge = (struct _wide_edge*)wf_malloc(sizeof(struct _wide_edge) * wide->edge_size);
+	if (!wide->node || !wide->edge) {
+		if (wide->node) wf_free(wide->node, sizeof(struct _trie) * wide->node_size);
+		if (wide->edge) wf_free(wide->edge, sizeof(struct _wide_edge) * wide->edge_size);
+		wf_free(wide, sizeof(*wide));
+		return NULL;
+	}
+	memset(wide->node, 0, sizeof(struct _trie) * wide->node_size);
+	memset(wide->edge, 0, sizeof(struct _wide_edge) * wide->edge_size);
+	wide->node_num = 1;
+	return wide;
 }
 
-void wf_free_ctx(wordfilterctxptr ctx) {
-	if (!ctx) return;
-
-	pool_deinit(ctx->pool);
-	wf_free(ctx, sizeof(*ctx));
+static void
+wide_free(struct _wide_trie* wide) {
+	if (!wide) return;
+	wf_free(wide->node, sizeof(struct _trie) * wide->node_size);
+	wf_free(wide->edge, sizeof(struct _wide_edge) * wide->edge_size);
+	wf_free(wide, sizeof(*wide));
 }
 
-int
-wf_search_word(wordfilterctxptr ctx, const char* word, char* word_key) {
-	return do_search_word(ctx, &ctx->word_root, &ctx->skip_word_root, word, word_key);
+static struct _wide_trie*
+wide_clone(struct _wide_trie* wide) {
+	if (!wide) return NULL;
+	struct _wide_trie* newwide = (struct _wide_trie*)wf_malloc(sizeof(*newwide));
+	if (!newwide) return NULL;
+	*newwide = *wide;
+	newwide->node = (struct _trie*)wf_malloc(sizeof(struct _trie) * wide->node_size);
+	newwide->edge = (struct _wide_edge*)wf_malloc(sizeof(struct _wide_edge) * wide->edge_size);
+	if (!newwide->node || !newwide->edge) {
+		if (newwide->node) wf_free(newwide->node, sizeof(struct _trie) * wide->node_size);
+		if (newwide->edge) wf_free(newwide->edge, sizeof(struct _wide_edge) * wide->edge_size);
+		wf_free(newwide, sizeof(*newwide));
+		return NULL;
+	}
+	memcpy(newwide->node, wide->node, sizeof(struct _trie) * wide->node_size);
+	memcpy(newwide->edge, wide->edge, sizeof(struct _wide_edge) * wide->edge_size);
+	return newwide;
 }
 
-int
-wf_search_word_ex(wordfilterctxptr ctx, const char* word, strnodeptr* strlist) {
-	const char* wordptr = word;
-	int find = 0;
-	strnodeptr strnode = NULL;
-	while (*wordptr) {
-		char word_key[MAX_WORD_LENGTH + 1] = {0};
-		int ret = wf_search_word(ctx, wordptr, word_key);
-		if (ret) {
-			find = 1; 
-			wordptr += ret;
-			if (strlist && !search_strnode(strnode, word_key))
-				strnode = insert_str(strnode, word_key);
-		}
-		else {
-			wordptr++;
-		}
+static inline uint32_t
+wide_child(const struct _wide_trie* wide, uint32_t parent, uint32_t cp) {
+	uint32_t i = wide_slot(parent, cp, wide->edge_size);
+	const struct _wide_edge* edge;
+	while ((edge = &wide->edge[i])->child) {
+		if (edge->parent == parent && edge->cp == cp) return edge->child;
+		if (++i == wide->edge_size) i = 0;
 	}
-	if (strlist)
-		*strlist = strnode;
-
-	return find;
+	return 0;
 }
 
 static int
-_fill_outstr(const char* wordptr, char* outstr, const char* word_key, int len, char mask_word) {
+wide_rehash(struct _wide_trie* wide, uint32_t newsize) {
+	struct _wide_edge* edge = (struct _wide_edge*)wf_malloc(sizeof(struct _wide_edge) * newsize);
+	if (!edge) return 0;
+	memset(edge, 0, sizeof(struct _wide_edge) * newsize);
+	uint32_t i, j;
+	for (i=0; i<wide->edge_size; i++) {
+		if (!wide->edge[i].child) continue;
+		j = wide_slot(wide->edge[i].parent, wide->edge[i].cp, newsize);
+		while (edge[j].child) {
+			if (++j == newsize) j = 0;
+		}
+		edge[j] = wide->edge[i];
+	}
+	wf_free(wide->edge, sizeof(struct _wide_edge) * wide->edge_size);
+	wide->edge = edge;
+	wide->edge_size = newsize;
+	return 1;
+}
+
+//return the new node, 0 if out of memory
+static uint32_t
+wide_add(struct _wide_trie* wide, uint32_t parent, uint32_t cp) {
+	if (wide->node_num == wide->node_size) {
+		uint32_t newsize = wide->node_size < 8 ? 16 : wide->node_size << 1;
+		struct _trie* node = (struct _trie*)wf_realloc(wide->node, sizeof(struct _trie) * newsize, sizeof(struct _trie) * wide->node_size);
+		if (!node) return 0;
+		wide->node = node;
+		wide->node_size = newsize;
+	}
+	//load factor 3/4
+	if ((wide->edge_num + 1) * 4 > wide->edge_size * 3 && !wide_rehash(wide, wide->edge_size << 1)) return 0;
+
+	uint32_t child = wide->node_num++;
+	memset(&wide->node[child], 0, sizeof(struct _trie));
+	uint32_t i = wide_slot(parent, cp, wide->edge_size);
+	while (wide->edge[i].child) {
+		if (++i == wide->edge_size) i = 0;
+	}
+	wide->edge[i] = (struct _wide_edge){parent, cp, child};
+	wide->edge_num++;
+	return child;
+}
+
+static inline size_t
+wide_get_memsize(struct _wide_trie* wide) {
+	return wide ? sizeof(struct _trie) * wide->node_size + sizeof(struct _wide_edge) * wide->edge_size : 0;
+}
+
+//trim the node array and the hash table for a built dictionary
+static int
+wide_compact(struct _wide_trie* wide) {
+	if (!wide) return 1;
+	uint32_t edge_size = wide->edge_num + wide->edge_num / 3 + 1;
+	if (edge_size < wide->edge_size && !wide_rehash(wide, edge_size)) return 0;
+	if (wide->node_num < wide->node_size) {
+		struct _trie* node = (struct _trie*)wf_realloc(wide->node, sizeof(struct _trie) * wide->node_num, sizeof(struct _trie) * wide->node_size);
+		if (!node) return 0;
+		wide->node = node;
+		wide->node_size = wide->node_num;
+	}
+	return 1;
+}
+
+static int
+wide_insert_word(wordfilterctxptr ctx, const char* word, uint32_t value) {
+	if (strlen(word) > MAX_WORD_LENGTH) return 0;
+
+	//the canonical bytes, for the length limit and the prefilter
+	byte key[MAX_WORD_LENGTH + 4];
+	int len = 0, i, n;
+	const char* p;
+	for (p=word; *p; p+=n) {
+		n = read_char(ctx, p, key + len, &i);
+		len += i;
+		if (len > MAX_WORD_LENGTH) return 0;
+	}
+	if (len == 0) return 1;
+
+	struct _wide_trie* wide = ctx->wide;
+	uint32_t node = 0;
+	for (p=word; *p; p+=n) {
+		uint32_t cp = read_cp(ctx, p, &n);
+		uint32_t child = wide_child(wide, node, cp);
+		if (!child && !(child = wide_add(wide, node, cp))) return 0;
+		node = child;
+	}
+	set_word(&wide->node[node], value);
+	if (ctx->qgram) qgram_add_key(ctx->qgram, key, len);
+	return 1;
+}
+
+//'key' is the canonical bytes, gaps are kept out of chains
+static int
+do_insert_key(wordfilterctxptr ctx, trieptr root, const byte* key, int len, uint32_t value) {
+	int gap = memchr(key, GAP_MARK, len) != NULL;
+	int i;
+	if (ctx->qgram && len) {
+		if (root == &ctx->word_root)
+			qgram_add_key(ctx->qgram, key, len);
+		else
+			ctx->qgram->skip[key[0] >> 5] |= 1u << (key[0] & 31);
+	}
+	trieptr node = root;
+	struct _trie_node_index node_index = {0,0,0};
+	i = 0;
+	while (i < len) {
+		if (trie_get_chain(node)) {
+			trieptr children = trie_get_children(ctx->pool, node);
+			const byte* label = trie_get_chain_label(children);
+			int label_len = label[0];
+			int matched = 0;
+			while (matched < label_len && i + matched < len && key[i + matched] == label[matched + 1])
+				matched++;
+
+			if (matched == label_len && i + matched < len && key[i + matched] == trie_get_data(children)) {
+				node_index = (struct _trie_node_index){trie_get_capacity_pool(node), trie_get_children_index(node), 0};
+				node = children;
+				i += label_len + 1;
+				if (i == len) set_word(node, value);
+				continue;
+			}
+
+			//the word leaves the chain in the middle, split it there
+			if (matched == 0) {
+				if (!split_chain(ctx, root, node_index, 1)) return 0;
+				node = get_node_by_index(ctx, root, node_index);
+				continue;
+			}
+			if (!split_chain(ctx, root, node_index, matched)) return 0;
+			node = get_node_by_index(ctx, root, node_index);
+			node_index = (struct _trie_node_index){trie_get_capacity_pool(node), trie_get_children_index(node), 0};
+			node = get_node_by_index(ctx, root, node_index);
+			i += matched;
+			if (i == len) {
+				set_word(node, value);
+			} else if (trie_get_chain(node)) {
+				if (!split_chain(ctx, root, node_index, 1)) return 0;
+				node = get_node_by_index(ctx, root, node_index);
+			}
+			continue;
+		}
+
+		int exist = 0;
+		byte index = binary_search(ctx, node, key[i], &exist);
+		byte isword = i + 1 == len;
+		if (exist) {
+			trieptr children = trie_get_children(ctx->pool, node);
+			node_index = (struct _trie_node_index){trie_get_capacity_pool(node), trie_get_children_index(node), index};
+			node = &children[index];
+			if (isword) set_word(node, value);
+			i++;
+			continue;
+		}
+
+		trieptr newnode = add_trie(ctx, &node, index, key[i], isword, value, node_index);
+		if (!newnode) return 0;
+		if (key[i] == GAP_MARK) trie_set_gap(node);
+		node_index = (struct _trie_node_index){trie_get_capacity_pool(node), trie_get_children_index(node), index};
+		node = newnode;
+		i++;
+
+		//the rest of the word is new, store it as one chain
+		if (len - i >= 2 && !gap) {
+			trieptr end = make_chain(ctx, root, node_index, key + i, len - i);
+			if (!end) return 0;
+			trie_set_isword(end, 1);
+			trie_set_payload(end, value);
+			break;
+		}
+	}
+	return 1;
+}
+
+static int
+do_insert_word(wordfilterctxptr ctx, trieptr root, const char* word, uint32_t value) {
+	if (ctx->wide && root == &ctx->word_root) return wide_insert_word(ctx, word, value);
+	if (strlen(word) > MAX_WORD_LENGTH) return 0;
+
+	byte key[MAX_WORD_LENGTH + 4];
+	int len = 0, i;
+	while (*word) {
+		word += read_char(ctx, word, key + len, &i);
+		if (key[len] == GAP_MARK) return 0;
+		len += i;
+		if (len > MAX_WORD_LENGTH) return 0;
+	}
+	return do_insert_key(ctx, root, key, len, value);
+}
+
+/*
+ * pattern:'?' is any one character, '{m,n}' m~n arbitrary characters, '{n}' n characters,
+ * '\\' quotes the next character. a pattern can't begin or end with a gap.
+ */
+static int
+do_insert_pattern(wordfilterctxptr ctx, trieptr root, const char* pattern, uint32_t value) {
+	if (ctx->wide || strlen(pattern) > MAX_WORD_LENGTH) return 0; //the gaps are in the byte trie only
+
+	byte key[MAX_WORD_LENGTH + 4];
+	int len = 0, gap_num = 0, i;
+	while (*pattern) {
+		int gap_min, gap_max;
+		if (*pattern == '?') {
+			gap_min = gap_max = 1;
+			pattern++;
+		} else if (*pattern == '{') {
+			char* end;
+			gap_min = gap_max = strtol(pattern + 1, &end, 10);
+			if (end == pattern + 1) return 0;
+			if (*end == ',') {
+				pattern = end + 1;
+				gap_max = strtol(pattern, &end, 10);
+				if (end == pattern) return 0;
+			}
+			if (*end != '}') return 0;
+			pattern = end + 1;
+		} else {
+			if (*pattern == '\\' && pattern[1]) pattern++;
+			pattern += read_char(ctx, pattern, key + len, &i);
+			if (key[len] == GAP_MARK) return 0;
+			len += i;
+			if (len > MAX_WORD_LENGTH) return 0;
+			continue;
+		}
+		if (len == 0 || gap_min < 0 || gap_max < gap_min) return 0;
+		if (len >= 3 && key[len-3] == GAP_MARK) {
+			//adjacent gaps are one gap
+			gap_min += key[len-2] - 1;
+			gap_max += key[len-1] - 1;
+			len -= 3;
+		} else if (++gap_num > MAX_GAP_NUM) {
+			return 0;
+		}
+		if (gap_max > MAX_GAP_LENGTH || gap_max == 0 || len + 3 > MAX_WORD_LENGTH) return 0;
+		key[len++] = GAP_MARK;
+		key[len++] = gap_min + 1;
+		key[len++] = gap_max + 1;
+	}
+	if (len == 0 || (len >= 3 && key[len-3] == GAP_MARK)) return 0;
+	return do_insert_key(ctx, root, key, len, value);
+}
+
+//catmask:only words in these categories match, the payload of the match is returned by 'value'
+struct _search_arg {
+	const char* begin; //the whole text
+	const char* word;  //the match start
+	uint32_t catmask;
+	int start;         //boundary before 'word', -1:not checked yet
+	int* allow;        //the length of the longest allowed word at 'word'
+	int gap_num;
+	uint32_t budget;   //the steps left, the walk stops at 0(wf_set_budget)
+	struct _gap_memo* memo; //the walks after the gaps, kept by the outermost walk_gap
+	struct _gap_spans* spans; //the gaps in the key being written, NULL:not wanted(wf_count_word only)
+};
+
+//the gaps a key walked through:key index, the characters filled in and the pattern's min~max
+struct _gap_spans {
+	int num;
+	byte at[MAX_GAP_NUM];
+	byte size[MAX_GAP_NUM];
+	byte min[MAX_GAP_NUM];
+	byte max[MAX_GAP_NUM];
+};
+
+/*
+ * the result of a walk after a gap only depends on the node, the text position and the key length,
+ * so every one is walked once for a start position. without it the gaps of a pattern
+ * cost up to 9^gaps walks. two ways a set, a collision only walks again.
+ */
+#define GAP_MEMO_SIZE 1024
+
+struct _gap_memo {
+	trieptr node[GAP_MEMO_SIZE];
+	uint32_t value[GAP_MEMO_SIZE];
+	uint16_t offset[GAP_MEMO_SIZE]; //the text position from the start
+	uint16_t word_key_index[GAP_MEMO_SIZE];
+	uint16_t ret[GAP_MEMO_SIZE];
+};
+
+static int walk_gap(wordfilterctxptr ctx, struct _trie_pool pool[8], struct _search_arg* arg, trieptr node,
+	const char* wordptr, int word_key_index, int skip_num, char* word_key, uint32_t* value);
+
+static int
+walk_word(wordfilterctxptr ctx, struct _trie_pool pool[8], struct _search_arg* arg, trieptr node,
+	const char* wordptr, int word_key_index, int skip_num, char* word_key, uint32_t* value) {
+	char c;
+	int ignorecase = ctx->ignorecase;
+	int equiv = ctx->equiv != NULL;
+	uint32_t budget = arg->budget; //kept in arg while the gaps are walked
+	int find = 0;
+	int pos = 0;
+	byte buf[4];
+	int len, n, i;
+	int gap_ret = 0;
+	char gap_key[MAX_WORD_LENGTH + 1];
+	struct _gap_spans gap_spans;
+	uint32_t gap_value = 0;
+
+	while ((c = *wordptr)) {
+		if (budget == 0) break;
+		budget--;
+		if (!equiv && (pos > 0 || (trie_get_chain(node) && trie_get_children(pool, node)))) {
+			//inside a chain:compare the label bytes directly
+			const byte* label = trie_get_chain_label(trie_get_children(pool, node)) + 1;
+			int label_len = label[-1];
+			while (pos < label_len) {
+				c = *wordptr;
+				if (ignorecase) c = wf_tolower(c);
+				if ((byte)c != label[pos]) break;
+				if (word_key) word_key[word_key_index] = *wordptr;
+				word_key_index++;
+				wordptr++;
+				pos++;
+			}
+			if (!*wordptr) break;
+		}
+		trieptr next;
+		int next_pos = pos;
+		if (!equiv) {
+			//one byte a step
+			c = *wordptr;
+			if (ignorecase) c = wf_tolower(c);
+			n = 1;
+			next = (byte)c == GAP_MARK ? NULL : trie_step(pool, node, &next_pos, c);
+		} else {
+			//a character may map to several canonical bytes(equivalence classes)
+			n = read_char(ctx, wordptr, buf, &len);
+			next = buf[0] == GAP_MARK ? NULL : node;
+			for (i=0; i<len && next; i++)
+				next = trie_step(pool, next, &next_pos, buf[i]);
+		}
+		if (word_key_index + n > MAX_WORD_LENGTH) break;
+		if (!next) {
+			//word not existed, try skip word
+			int skip = search_skip_word(ctx, &wordptr);
+			if (!skip) break;
+			skip_num += skip;
+			continue;
+		}
+		if (word_key) {
+			if (n == 1) word_key[word_key_index] = *wordptr;
+			else memcpy(word_key + word_key_index, wordptr, n);
+		}
+
+		word_key_index += n;
+		node = next;
+		pos = next_pos;
+
+		wordptr += n;
+		if (pos != 0) continue;
+		if (trie_get_gap(node) && arg->gap_num < MAX_GAP_NUM) {
+			uint32_t v = 0;
+			char key[MAX_WORD_LENGTH + 1];
+			struct _gap_spans* spans = arg->spans, key_spans;
+			if (word_key) memcpy(key, word_key, word_key_index);
+			if (word_key && spans) {
+				//the gaps of 'key' go with it
+				key_spans = *spans;
+				arg->spans = &key_spans;
+			}
+			arg->budget = budget;
+			int ret = walk_gap(ctx, pool, arg, node, wordptr, word_key_index, skip_num,
+				word_key ? key : NULL, &v);
+			budget = arg->budget;
+			arg->spans = spans;
+			if (ret > gap_ret) {
+				if (word_key) strcpy(gap_key, key);
+				if (word_key && spans) gap_spans = key_spans;
+				gap_ret = ret;
+				gap_value = v;
+			}
+		}
+		if (!trie_get_isword(node)) continue;
+		if (trie_get_category(node) & arg->catmask) {
+			int whole = !(node->value & WORD_FLAG_WHOLE);
+			if (!whole) {
+				if (arg->start < 0) arg->start = boundary_before(arg->begin, arg->word);
+				whole = arg->start && boundary_after(wordptr);
+			}
+			if (whole) {
+				find = word_key_index;
+				if (value) *value = node->value;
+			}
+		}
+		if (arg->allow && (node->value & WORD_FLAG_ALLOW) && wordptr - arg->word > *arg->allow)
+			*arg->allow = wordptr - arg->word;
+	}
+	arg->budget = budget;
+	int ret = find ? (find + skip_num) : 0;
+	if (gap_ret > ret) {
+		if (word_key) strcpy(word_key, gap_key);
+		if (word_key && arg->spans) *arg->spans = gap_spans;
+		if (value) *value = gap_value;
+		return gap_ret;
+	}
+	if (word_key) word_key[find] = 0;
+	return ret;
+}
+
+//walk_word after a gap without the key, found in the memo if it is walked before
+static int
+walk_after_gap(wordfilterctxptr ctx, struct _trie_pool pool[8], struct _search_arg* arg, trieptr node,
+	const char* wordptr, int word_key_index, int skip_num, uint32_t* value) {
+	struct _gap_memo* memo = arg->memo;
+	size_t offset = wordptr - arg->word;
+	if (offset > 0xFFFF - MAX_WORD_LENGTH)
+		return walk_word(ctx, pool, arg, node, wordptr, word_key_index, skip_num, NULL, value);
+	uint32_t h = (uint32_t)((uintptr_t)node >> 2) * 0x9E3779B1u + (uint32_t)offset * 0x85EBCA77u + word_key_index;
+	h = ((h ^ (h >> 15)) * 0x2C1B3C6Du) >> 22 & (GAP_MEMO_SIZE - 2);
+	uint32_t i;
+	for (i=h; i<h+2 && memo->node[i]; i++) {
+		if (memo->node[i] == node && memo->offset[i] == offset && memo->word_key_index[i] == word_key_index) {
+			*value = memo->value[i];
+			return memo->ret[i];
+		}
+	}
+	if (i == h + 2) i = h + (offset & 1);
+	uint32_t v = 0;
+	int ret = walk_word(ctx, pool, arg, node, wordptr, word_key_index, skip_num, NULL, &v);
+	*value = v;
+	if (ret > 0xFFFF) return ret;
+	memo->node[i] = node;
+	memo->value[i] = v;
+	memo->offset[i] = offset;
+	memo->word_key_index[i] = word_key_index;
+	memo->ret[i] = ret;
+	return ret;
+}
+
+//try every length of the gaps after 'node', the characters in a gap are part of the match.
+//the lengths are tried without the key, then the best one is walked again for it
+static int
+walk_gap(wordfilterctxptr ctx, struct _trie_pool pool[8], struct _search_arg* arg, trieptr node,
+	const char* wordptr, int word_key_index, int skip_num, char* word_key, uint32_t* value) {
+	int pos = 0, best = 0;
+	trieptr mark = trie_step(pool, node, &pos, GAP_MARK);
+	if (!mark) return 0;
+	struct _gap_memo memo;
+	int outermost = arg->memo == NULL;
+	if (outermost) {
+		memset(memo.node, 0, sizeof(memo.node));
+		arg->memo = &memo;
+	}
+	trieptr best_node = NULL;
+	const char* best_ptr = NULL;
+	int best_size = 0, best_min = 0, best_max = 0;
+	trieptr min_nodes = trie_get_children(pool, mark);
+	byte min_capacity = trie_get_capacity(mark);
+	int i, j;
+	arg->gap_num++;
+	for (i=0; i<min_capacity && trie_get_data(&min_nodes[i]); i++) {
+		int gap_min = trie_get_data(&min_nodes[i]) - 1;
+		trieptr max_nodes = trie_get_children(pool, &min_nodes[i]);
+		byte max_capacity = trie_get_capacity(&min_nodes[i]);
+		for (j=0; j<max_capacity && trie_get_data(&max_nodes[j]); j++) {
+			int gap_max = trie_get_data(&max_nodes[j]) - 1;
+			const char* p = wordptr;
+			int gap, size = 0;
+			for (gap=0; gap<=gap_max && arg->budget; gap++) {
+				if (gap >= gap_min) {
+					uint32_t v = 0;
+					int ret = walk_after_gap(ctx, pool, arg, &max_nodes[j], p, word_key_index + size, skip_num, &v);
+					if (ret > best) {
+						best = ret;
+						*value = v;
+						best_node = &max_nodes[j];
+						best_ptr = p;
+						best_size = size;
+						best_min = gap_min;
+						best_max = gap_max;
+					}
+				}
+				if (!*p) break;
+				uint32_t cp;
+				int n = utf8_decode(p, &cp);
+				if (word_key_index + size + n > MAX_WORD_LENGTH) break;
+				p += n;
+				size += n;
+			}
+		}
+	}
+	if (best && word_key) {
+		memcpy(word_key + word_key_index, wordptr, best_size);
+		struct _gap_spans* spans = arg->spans;
+		if (spans && spans->num < MAX_GAP_NUM) {
+			spans->at[spans->num] = word_key_index;
+			spans->size[spans->num] = best_size;
+			spans->min[spans->num] = best_min;
+			spans->max[spans->num] = best_max;
+			spans->num++;
+		}
+		best = walk_word(ctx, pool, arg, best_node, best_ptr, word_key_index + best_size, skip_num, word_key, value);
+	}
+	arg->gap_num--;
+	if (outermost) arg->memo = NULL;
+	return best;
+}
+
+//walk_word of the code point mode
+static int
+walk_wide(wordfilterctxptr ctx, struct _search_arg* arg, const char* wordptr, char* word_key, uint32_t* value) {
+	const struct _wide_trie* wide = ctx->wide;
+	uint32_t node = 0;
+	int word_key_index = 0, skip_num = 0, find = 0, n;
+	while (*wordptr && arg->budget) {
+		arg->budget--;
+		uint32_t cp = read_cp(ctx, wordptr, &n);
+		if (word_key_index + n > MAX_WORD_LENGTH) break;
+		uint32_t next = wide_child(wide, node, cp);
+		if (!next) {
+			int skip = search_skip_word(ctx, &wordptr);
+			if (!skip) break;
+			skip_num += skip;
+			continue;
+		}
+		if (word_key) memcpy(word_key + word_key_index, wordptr, n);
+		word_key_index += n;
+		wordptr += n;
+		node = next;
+
+		const struct _trie* p = &wide->node[node];
+		if (!trie_get_isword(p)) continue;
+		if (trie_get_category(p) & arg->catmask) {
+			int whole = !(p->value & WORD_FLAG_WHOLE);
+			if (!whole) {
+				if (arg->start < 0) arg->start = boundary_before(arg->begin, arg->word);
+				whole = arg->start && boundary_after(wordptr);
+			}
+			if (whole) {
+				find = word_key_index;
+				if (value) *value = p->value;
+			}
+		}
+		if (arg->allow && (p->value & WORD_FLAG_ALLOW) && wordptr - arg->word > *arg->allow)
+			*arg->allow = wordptr - arg->word;
+	}
+	if (word_key) word_key[find] = 0;
+	return find ? (find + skip_num) : 0;
+}
+
+static int
+do_search_word(wordfilterctxptr ctx, struct _trie_pool pool[8], trieptr word_root, const char* begin, const char* word,
+	char* word_key, uint32_t catmask, uint32_t* value, int* allow, uint32_t* budget, struct _gap_spans* spans) {
+	struct _search_arg arg = {begin, word, catmask, -1, allow, 0, budget ? *budget : UINT32_MAX};
+	arg.spans = spans;
+	int ret = walk_word(ctx, pool, &arg, word_root, word, 0, 0, word_key, value);
+	if (budget) *budget = arg.budget;
+	return ret;
+}
+
+/*
+ * the longer match of the context and the words layered on it.
+ * budget(or NULL):the steps left for the walks, the match is not complete if it becomes 0.
+ * spans(or NULL):gets the gaps in 'word_key'.
+ */
+static int
+search_word(wordfilterctxptr ctx, const char* begin, const char* word, char* word_key, uint32_t catmask, uint32_t* value,
+	int* allow, uint32_t* budget, struct _gap_spans* spans) {
+	if (spans) spans->num = 0;
+	if (ctx->wide) {
+		struct _search_arg arg = {begin, word, catmask, -1, allow, 0, budget ? *budget : UINT32_MAX};
+		int ret = walk_wide(ctx, &arg, word, word_key, value);
+		if (budget) *budget = arg.budget;
+		return ret;
+	}
+	int ret = do_search_word(ctx, ctx->pool, &ctx->word_root, begin, word, word_key, catmask, value, allow, budget, spans);
+	if (ctx->overlay) {
+		char overlay_key[MAX_WORD_LENGTH + 1];
+		struct _gap_spans overlay_spans = {0};
+		uint32_t overlay_value = 0;
+		int overlay_allow = 0;
+		int overlay_ret = do_search_word(ctx, ctx->overlay->pool, &ctx->overlay->word_root, begin, word,
+			word_key ? overlay_key : NULL, catmask, &overlay_value, &overlay_allow, budget, spans ? &overlay_spans : NULL);
+		if (allow && overlay_allow > *allow) *allow = overlay_allow;
+		if (overlay_ret > ret) {
+			ret = overlay_ret;
+			if (word_key) strcpy(word_key, overlay_key);
+			if (spans) *spans = overlay_spans;
+			if (value) *value = overlay_value;
+		} else if (ret && overlay_ret == ret && value) {
+			//the word is in both tries:the layered insert is merged like an insert again
+			*value = merge_value(*value, overlay_value);
+		}
+	}
+	return ret;
+}
+
+//the slots a trimmed copy of the children block needs, 'n' gets the real nodes in it
+static inline uint32_t
+trie_get_block_size(struct _trie_pool pool[8], trieptr node, byte* n) {
+	trieptr children = trie_get_children(pool, node);
+	*n = 0;
+	if (!children) return 0;
+	if (trie_get_chain(node)) {
+		*n = 1;
+		return get_chain_block_size(trie_get_chain_label(children)[0]);
+	}
+	byte capacity = trie_get_capacity(node);
+	while (*n < capacity && trie_get_data(&children[*n]) != 0) (*n)++;
+	return *n;
+}
+
+static size_t
+pool_get_memsize(struct _trie_pool pool[8]) {
+	size_t size = 0;
+	int i;
+	for (i=0; i<8; i++) {
+		struct _trie_pool_free_node* freenode = pool[i].freelist;
+		while (freenode) {
+			size += sizeof(*freenode);
+			freenode = freenode->next;
+		}
+		size += pool[i].pool_size * get_pool_unit_size(i);
+	}
+	return size;
+}
+
+struct _compact_item {
+	trieptr from;
+	trieptr to;
+};
+
+//rewrite both tries into fresh pools in breadth-first order, every children block trimmed to the smallest size class
+static int
+pool_compact(wordfilterctxptr ctx) {
+	struct _trie_pool newpool[8];
+	uint32_t need[8] = {0};
+	uint32_t node_num = 2, head = 0, tail = 0;
+	struct _compact_item* queue;
+	int i;
+
+	//first pass:count the blocks of each size class, so the new pools never move while copying
+	queue = (struct _compact_item*)wf_malloc(sizeof(*queue) * node_num);
+	if (!queue) return 0;
+	queue[tail++].from = &ctx->word_root;
+	queue[tail++].from = &ctx->skip_word_root;
+	while (head < tail) {
+		trieptr node = queue[head++].from;
+		byte n;
+		uint32_t block_size = trie_get_block_size(ctx->pool, node, &n);
+		if (block_size == 0) continue;
+		need[ceil_log2(block_size)-1]++;
+		if (tail + n > node_num) {
+			uint32_t newsize = node_num;
+			while (tail + n > newsize) newsize <<= 1;
+			struct _compact_item* newqueue = (struct _compact_item*)wf_realloc(queue, sizeof(*queue) * newsize, sizeof(*queue) * node_num);
+			if (!newqueue) {
+				wf_free(queue, sizeof(*queue) * node_num);
+				return 0;
+			}
+			queue = newqueue;
+			node_num = newsize;
+		}
+		trieptr children = trie_get_children(ctx->pool, node);
+		for (i=0; i<n; i++) queue[tail++].from = &children[i];
+	}
+
+	memset(newpool, 0, sizeof(newpool));
+	for (i=0; i<8; i++) {
+		if (need[i] == 0) continue;
+		size_t size = need[i] * get_pool_unit_size(i);
+		newpool[i].pool = (trieptr)wf_malloc(size);
+		if (!newpool[i].pool) {
+			pool_deinit(newpool);
+			wf_free(queue, sizeof(*queue) * node_num);
+			return 0;
+		}
+		memset(newpool[i].pool, 0, size);
+		newpool[i].pool_size = need[i];
+	}
+
+	//second pass:copy the nodes level by level
+	struct _trie word_root = ctx->word_root, skip_word_root = ctx->skip_word_root;
+	head = tail = 0;
+	queue[tail++] = (struct _compact_item){&ctx->word_root, &word_root};
+	queue[tail++] = (struct _compact_item){&ctx->skip_word_root, &skip_word_root};
+	while (head < tail) {
+		struct _compact_item item = queue[head++];
+		byte n;
+		uint32_t block_size = trie_get_block_size(ctx->pool, item.from, &n);
+		if (block_size == 0) {
+			trie_set_rawcapacity(item.to, 0);
+			trie_set_children_index(item.to, 0);
+			continue;
+		}
+		uint32_t pool_index = ceil_log2(block_size)-1;
+		uint32_t index = ++newpool[pool_index].pool_tail;
+		trie_set_capacity(item.to, block_size);
+		trie_set_children_index(item.to, index);
+
+		trieptr from_children = trie_get_children(ctx->pool, item.from);
+		trieptr to_children = trie_get_children(newpool, item.to);
+		memcpy(to_children, from_children, block_size * sizeof(struct _trie));
+		for (i=0; i<n; i++) {
+			queue[tail++] = (struct _compact_item){&from_children[i], &to_children[i]};
+		}
+	}
+	wf_free(queue, sizeof(*queue) * node_num);
+
+	pool_deinit(ctx->pool);
+	memcpy(ctx->pool, newpool, sizeof(newpool));
+	ctx->word_root = word_root;
+	ctx->skip_word_root = skip_word_root;
+	return 1;
+}
+
+struct _minimize_block {
+	uint32_t hash;
+	uint32_t pool_index;
+	uint32_t index;
+};
+
+struct _minimize_table {
+	struct _minimize_block* slot;
+	uint32_t size;
+	uint32_t count;
+	struct _trie_pool pool[8];
+};
+
+static inline uint32_t
+hash_block(const byte* p, size_t len) {
+	uint32_t h = 2166136261u;
+	size_t i;
+	for (i=0; i<len; i++) {
+		h ^= p[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static int
+minimize_table_grow(struct _minimize_table* table) {
+	uint32_t newsize = table->size ? table->size << 1 : 1024;
+	struct _minimize_block* slot = (struct _minimize_block*)wf_malloc(sizeof(*slot) * newsize);
+	if (!slot) return 0;
+	memset(slot, 0, sizeof(*slot) * newsize);
+	uint32_t i;
+	for (i=0; i<table->size; i++) {
+		struct _minimize_block* block = &table->slot[i];
+		if (!block->index) continue;
+		uint32_t pos = block->hash & (newsize - 1);
+		while (slot[pos].index) pos = (pos + 1) & (newsize - 1);
+		slot[pos] = *block;
+	}
+	if (table->slot)
+		wf_free(table->slot, sizeof(*slot) * table->size);
+	table->slot = slot;
+	table->size = newsize;
+	return 1;
+}
+
+//copy 'from' into 'to', its children block is shared with an equal block copied before
+static int
+minimize_node(wordfilterctxptr ctx, struct _minimize_table* table, trieptr from, trieptr to) {
+	byte n;
+	uint32_t block_size = trie_get_block_size(ctx->pool, from, &n);
+	*to = *from;
+	if (block_size == 0) {
+		trie_set_rawcapacity(to, 0);
+		trie_set_children_index(to, 0);
+		return 1;
+	}
+
+	size_t size = block_size * sizeof(struct _trie);
+	trieptr from_children = trie_get_children(ctx->pool, from);
+	trieptr block = (trieptr)wf_malloc(size);
+	if (!block) return 0;
+	memcpy(block, from_children, size);
+	int i;
+	for (i=0; i<n; i++) {
+		if (!minimize_node(ctx, table, &from_children[i], &block[i])) {
+			wf_free(block, size);
+			return 0;
+		}
+	}
+
+	uint32_t pool_index = ceil_log2(block_size)-1;
+	uint32_t hash = hash_block((const byte*)block, size);
+	if ((table->count + 1) * 2 > table->size && !minimize_table_grow(table)) {
+		wf_free(block, size);
+		return 0;
+	}
+	uint32_t pos = hash & (table->size - 1);
+	while (table->slot[pos].index) {
+		struct _minimize_block* same = &table->slot[pos];
+		if (same->hash == hash && same->pool_index == pool_index &&
+			memcmp(pool_get_trie(table->pool, pool_index, same->index), block, size) == 0)
+			break;
+		pos = (pos + 1) & (table->size - 1);
+	}
+	if (!table->slot[pos].index) {
+		uint32_t index = pool_alloc(table->pool, pool_index);
+		if (!index) {
+			wf_free(block, size);
+			return 0;
+		}
+		memcpy(pool_get_trie(table->pool, pool_index, index), block, size);
+		table->slot[pos] = (struct _minimize_block){hash, pool_index, index};
+		table->count++;
+	}
+	trie_set_capacity(to, block_size);
+	trie_set_children_index(to, table->slot[pos].index);
+	wf_free(block, size);
+	return 1;
+}
+
+//merge equal subtrees of both tries, the result is a DAWG in fresh pools
+static int
+pool_minimize(wordfilterctxptr ctx) {
+	struct _minimize_table table;
+	struct _trie word_root, skip_word_root;
+	memset(&table, 0, sizeof(table));
+	if (!minimize_node(ctx, &table, &ctx->word_root, &word_root) ||
+		!minimize_node(ctx, &table, &ctx->skip_word_root, &skip_word_root)) {
+		if (table.slot) wf_free(table.slot, sizeof(*table.slot) * table.size);
+		pool_deinit(table.pool);
+		return 0;
+	}
+	if (table.slot) wf_free(table.slot, sizeof(*table.slot) * table.size);
+
+	//drop the unused tail of each pool
+	int i;
+	for (i=0; i<8; i++) {
+		struct _trie_pool* mypool = &table.pool[i];
+		if (mypool->pool_tail == mypool->pool_size) continue;
+		size_t unitsize = get_pool_unit_size(i);
+		if (mypool->pool_tail == 0) {
+			wf_free(mypool->pool, mypool->pool_size * unitsize);
+			mypool->pool = NULL;
+		} else {
+			mypool->pool = (trieptr)wf_realloc(mypool->pool, mypool->pool_tail * unitsize, mypool->pool_size * unitsize);
+		}
+		mypool->pool_size = mypool->pool_tail;
+	}
+
+	pool_deinit(ctx->pool);
+	memcpy(ctx->pool, table.pool, sizeof(table.pool));
+	ctx->word_root = word_root;
+	ctx->skip_word_root = skip_word_root;
+	return 1;
+}
+
+int
+wf_word_isempty(wordfilterctxptr ctx) {
+	if (!ctx) return 1;
+	if (ctx->wide) return ctx->wide->edge_num == 0;
+	trieptr children = trie_get_children(ctx->pool, &ctx->word_root);
+	return (children == NULL || trie_get_data(children) == 0) && wf_word_isempty(ctx->overlay);
+}
+
+int
+wf_skipword_isempty(wordfilterctxptr ctx) {
+	if (!ctx) return 1;
+	trieptr children = trie_get_children(ctx->pool, &ctx->skip_word_root);
+	return (children == NULL || trie_get_data(children) == 0) && wf_skipword_isempty(ctx->overlay);
+}
+
+//words added to a read only context are layered on it
+static wordfilterctxptr
+get_overlay(wordfilterctxptr ctx) {
+	if (!ctx->overlay) {
+		ctx->overlay = wf_create_ctx();
+		if (ctx->overlay) {
+			ctx->overlay->ignorecase = ctx->ignorecase;
+			ctx->overlay->equiv = equiv_clone(ctx->equiv);
+		}
+	}
+	return ctx->overlay;
+}
+
+int
+wf_insert_word(wordfilterctxptr ctx, const char* word) {
+	return wf_insert_word_ex(ctx, word, WF_CATEGORY_DEFAULT, 0);
+}
+
+//a word inserted again keeps the union of its categories and the highest severity
+int
+wf_insert_word_ex(wordfilterctxptr ctx, const char* word, uint16_t category, byte severity) {
+	if (!category) return 0;
+	touch_ctx(ctx);
+	if (ctx->readonly) {
+		wordfilterctxptr overlay = get_overlay(ctx);
+		return overlay ? wf_insert_word_ex(overlay, word, category, severity) : 0;
+	}
+	return do_insert_word(ctx, &ctx->word_root, word, trie_make_value(category, severity));
+}
+
+//the word only matches as a whole word, e.g. "ass" matches "an ass!" but not "class".
+//0 if a read only context has it as a plain word
+int
+wf_insert_whole_word(wordfilterctxptr ctx, const char* word, uint16_t category, byte severity) {
+	if (!category) return 0;
+	touch_ctx(ctx);
+	if (ctx->readonly) {
+		//the layer can't stop the plain word of the base from matching inside other words
+		uint32_t value = 0;
+		if (do_search_word(ctx, ctx->pool, &ctx->word_root, word, word, NULL, WF_CATEGORY_ALL, &value, NULL, NULL, NULL)
+			== (int)strlen(word) && !(value & WORD_FLAG_WHOLE)) return 0;
+		wordfilterctxptr overlay = get_overlay(ctx);
+		return overlay ? wf_insert_whole_word(overlay, word, category, severity) : 0;
+	}
+	return do_insert_word(ctx, &ctx->word_root, word, trie_make_value(category, severity) | WORD_FLAG_WHOLE);
+}
+
+//a banned match inside an allowed word(e.g. "classic") is not reported
+int
+wf_insert_allow_word(wordfilterctxptr ctx, const char* word) {
+	touch_ctx(ctx);
+	if (ctx->readonly) {
+		wordfilterctxptr overlay = get_overlay(ctx);
+		return overlay ? wf_insert_allow_word(overlay, word) : 0;
+	}
+	return do_insert_word(ctx, &ctx->word_root, word, WORD_FLAG_ALLOW);
+}
+
+int
+wf_insert_pattern(wordfilterctxptr ctx, const char* pattern, uint16_t category, byte severity) {
+	if (!category) return 0;
+	touch_ctx(ctx);
+	if (ctx->readonly) {
+		wordfilterctxptr overlay = get_overlay(ctx);
+		return overlay ? wf_insert_pattern(overlay, pattern, category, severity) : 0;
+	}
+	return do_insert_pattern(ctx, &ctx->word_root, pattern, trie_make_value(category, severity));
+}
+
+int
+wf_insert_skip_word(wordfilterctxptr ctx, const char* word) {
+	touch_ctx(ctx);
+	if (ctx->readonly) {
+		wordfilterctxptr overlay = get_overlay(ctx);
+		return overlay ? wf_insert_skip_word(overlay, word) : 0;
+	}
+	return do_insert_word(ctx, &ctx->skip_word_root, word, 0);
+}
+
+/*
+ * parallel build:the words are sharded by their first canonical byte, and by the second one too after
+ * a non ascii byte(the lead bytes of CJK are few). every thread inserts its shards into a context of
+ * its own, then the pools are appended to the target with the children indexes relocated, the root
+ * children are stitched together and the first level nodes built by several threads are merged.
+ */
+#define MAX_BUILD_THREAD 64
+#define BUILD_BUCKET_NUM 0x10000
+
+struct _build_arg {
+	wordfilterctxptr shard;
+	wordfilterctxptr ctx;
+	const char** words;
+	const uint16_t* bucket; //the bucket of every word
+	const byte* owner;      //bucket -> thread
+	size_t num;
+	int id;
+	int ok;
+	uint32_t value;
+	uint32_t offset[8];     //where the pools of 'shard' are appended
+	struct _trie root;      //the root of 'shard' relocated
+};
+
+static inline uint16_t
+build_bucket(wordfilterctxptr ctx, const char* word) {
+	byte key[8];
+	int len, n;
+	if (!*word) return 0;
+	n = read_char(ctx, word, key, &len);
+	if (key[0] < 0x80) return key[0];
+	if (len == 1) {
+		if (word[n]) read_char(ctx, word + n, key + 1, &len);
+		else key[1] = 0;
+	}
+	return (key[0] << 8) | key[1];
+}
+
+static void*
+build_shard(void* p) {
+	struct _build_arg* arg = (struct _build_arg*)p;
+	wordfilterctxptr shard = arg->shard;
+	size_t i;
+	for (i=0; i<arg->num; i++) {
+		if (arg->owner[arg->bucket[i]] != arg->id) continue;
+		if (!do_insert_word(shard, &shard->word_root, arg->words[i], arg->value)) arg->ok = 0;
+	}
+	return NULL;
+}
+
+static void
+relocate_node(struct _trie_pool pool[8], trieptr node, const uint32_t offset[8]) {
+	uint32_t index = trie_get_children_index(node);
+	if (!index) return;
+	trie_set_children_index(node, index + offset[trie_get_capacity_pool(node)]);
+	trieptr children = trie_get_children(pool, node);
+	if (trie_get_chain(node)) {
+		relocate_node(pool, children, offset);
+		return;
+	}
+	byte capacity = trie_get_capacity(node);
+	int i;
+	for (i=0; i<capacity && trie_get_data(&children[i]); i++)
+		relocate_node(pool, &children[i], offset);
+}
+
+//copy the pools of the shard to their place in the target
+static void*
+build_append(void* p) {
+	struct _build_arg* arg = (struct _build_arg*)p;
+	int i;
+	for (i=0; i<8; i++) {
+		uint32_t tail = arg->shard->pool[i].pool_tail;
+		if (tail)
+			memcpy(arg->ctx->pool[i].pool + arg->offset[i] * (twoto(i+1)-1), arg->shard->pool[i].pool, tail * get_pool_unit_size(i));
+	}
+	arg->root = arg->shard->word_root;
+	relocate_node(arg->ctx->pool, &arg->root, arg->offset);
+	return NULL;
+}
+
+static int
+build_run(struct _build_arg* args, int threads, void* (*func)(void*)) {
+	pthread_t tid[MAX_BUILD_THREAD];
+	int i, n;
+	for (n=1; n<threads; n++) {
+		if (pthread_create(&tid[n], NULL, func, &args[n]) != 0) break;
+	}
+	func(&args[0]);
+	for (i=1; i<n; i++) pthread_join(tid[i], NULL);
+	//a thread that could not start is run here
+	for (i=n; i<threads; i++) func(&args[i]);
+	return 1;
+}
+
+//a new children block for the nodes, sorted by their data
+static int
+build_block(wordfilterctxptr ctx, trieptr node, const struct _trie* nodes, int n) {
+	byte capacity = 1;
+	int i, j;
+	while (capacity < n) capacity = (capacity << 1) + 1;
+	trie_set_capacity(node, capacity);
+	trie_set_chain(node, 0);
+	uint32_t index = pool_alloc(ctx->pool, trie_get_capacity_pool(node));
+	if (!index) return 0;
+	trie_set_children_index(node, index);
+	trieptr children = trie_get_children(ctx->pool, node);
+	memset(children, 0, sizeof(struct _trie) * capacity);
+	for (i=0; i<n; i++) {
+		for (j=i; j>0 && trie_get_data(&children[j-1]) > trie_get_data(&nodes[i]); j--)
+			children[j] = children[j-1];
+		children[j] = nodes[i];
+	}
+	return 1;
+}
+
+static void
+free_block(wordfilterctxptr ctx, trieptr node) {
+	if (trie_get_children_index(node))
+		pool_free(ctx->pool, trie_get_capacity_pool(node), trie_get_children_index(node));
+}
+
+//put the relocated shards under the root of the target
+static int
+build_stitch(wordfilterctxptr ctx, struct _build_arg* args, int threads) {
+	struct _trie first[256]; //the root children
+	struct _trie nodes[256], children[256];
+	int shared[256] = {0};
+	int i, t, n = 0, m;
+	memset(first, 0, sizeof(first));
+	for (t=0; t<threads; t++) {
+		//copied, the pools may move while merging
+		trieptr root_children = trie_get_children(ctx->pool, &args[t].root);
+		byte capacity = trie_get_capacity(&args[t].root);
+		for (m=0; root_children && m<capacity && trie_get_data(&root_children[m]); m++)
+			children[m] = root_children[m];
+		for (i=0; i<m; i++) {
+			byte c = trie_get_data(&children[i]);
+			if (shared[c]++ == 0) {
+				first[c] = children[i];
+				continue;
+			}
+			//built by several threads:the children are disjoint, merge them
+			trieptr a = &first[c], b = &children[i];
+			trieptr achildren = trie_get_children(ctx->pool, a), bchildren = trie_get_children(ctx->pool, b);
+			byte acapacity = trie_get_capacity(a), bcapacity = trie_get_capacity(b);
+			int k = 0;
+			for (n=0; achildren && n<acapacity && trie_get_data(&achildren[n]); n++) nodes[k++] = achildren[n];
+			for (n=0; bchildren && n<bcapacity && trie_get_data(&bchildren[n]); n++) nodes[k++] = bchildren[n];
+			struct _trie merged = *a;
+			if (trie_get_isword(b)) set_word(&merged, b->value);
+			if (!build_block(ctx, &merged, nodes, k)) return 0;
+			free_block(ctx, a);
+			free_block(ctx, b);
+			*a = merged;
+		}
+		free_block(ctx, &args[t].root);
+	}
+	for (i=1, n=0; i<256; i++) {
+		if (shared[i]) nodes[n++] = first[i];
+	}
+	free_block(ctx, &ctx->word_root);
+	trie_set_children_index(&ctx->word_root, 0);
+	return n ? build_block(ctx, &ctx->word_root, nodes, n) : 1;
+}
+
+//the nodes of the first level are merged as plain nodes, so the chains there are split first
+static int
+build_split(struct _build_arg* args, int threads) {
+	int count[256] = {0};
+	int i, t;
+	for (t=0; t<threads; t++) {
+		wordfilterctxptr shard = args[t].shard;
+		trieptr children = trie_get_children(shard->pool, &shard->word_root);
+		byte capacity = trie_get_capacity(&shard->word_root);
+		for (i=0; children && i<capacity && trie_get_data(&children[i]); i++)
+			count[trie_get_data(&children[i])]++;
+	}
+	for (t=0; t<threads; t++) {
+		wordfilterctxptr shard = args[t].shard;
+		trieptr root = &shard->word_root;
+		byte capacity = trie_get_capacity(root);
+		for (i=0; i<capacity; i++) {
+			trieptr children = trie_get_children(shard->pool, root);
+			if (!children || !trie_get_data(&children[i])) break;
+			if (count[trie_get_data(&children[i])] < 2 || !trie_get_chain(&children[i])) continue;
+			struct _trie_node_index node_index = {trie_get_capacity_pool(root), trie_get_children_index(root), i};
+			if (!split_chain(shard, root, node_index, 1)) return 0;
+		}
+	}
+	return 1;
+}
+
+struct _build_load {
+	size_t num;
+	uint32_t bucket;
+};
+
+static int
+build_load_cmp(const void* a, const void* b) {
+	size_t x = ((const struct _build_load*)a)->num, y = ((const struct _build_load*)b)->num;
+	return x < y ? 1 : x > y ? -1 : (int)((const struct _build_load*)a)->bucket - (int)((const struct _build_load*)b)->bucket;
+}
+
+static int
+build_parallel(wordfilterctxptr ctx, const char** words, size_t num, uint32_t value, int threads) {
+	struct _build_arg args[MAX_BUILD_THREAD];
+	struct _build_load* load = (struct _build_load*)wf_malloc(sizeof(*load) * BUILD_BUCKET_NUM);
+	byte* owner = (byte*)wf_malloc(BUILD_BUCKET_NUM);
+	uint16_t* bucket = (uint16_t*)wf_malloc(sizeof(uint16_t) * num);
+	int ok = load && owner && bucket;
+	size_t i, sum[MAX_BUILD_THREAD] = {0};
+	int t, k, used = 0;
+	memset(args, 0, sizeof(args));
+	if (ok) {
+		for (i=0; i<BUILD_BUCKET_NUM; i++) load[i] = (struct _build_load){0, i};
+		for (i=0; i<num; i++) load[bucket[i] = build_bucket(ctx, words[i])].num++;
+		qsort(load, BUILD_BUCKET_NUM, sizeof(*load), build_load_cmp);
+		while (used < BUILD_BUCKET_NUM && load[used].num) used++;
+		if (threads > used) threads = used;
+		//the biggest bucket goes to the thread with the least words
+		for (i=0; i<(size_t)used; i++) {
+			for (t=1, k=0; t<threads; t++) {
+				if (sum[t] < sum[k]) k = t;
+			}
+			owner[load[i].bucket] = k;
+			sum[k] += load[i].num;
+		}
+	}
+
+	for (t=0; ok && t<threads; t++) {
+		struct _build_arg* arg = &args[t];
+		arg->ctx = ctx;
+		arg->words = words;
+		arg->bucket = bucket;
+		arg->owner = owner;
+		arg->num = num;
+		arg->id = t;
+		arg->ok = 1;
+		arg->value = value;
+		if (!(arg->shard = wf_create_ctx())) ok = 0;
+		else {
+			arg->shard->ignorecase = ctx->ignorecase;
+			arg->shard->equiv = ctx->equiv;
+		}
+	}
+	if (ok) {
+		build_run(args, threads, build_shard);
+		ok = build_split(args, threads);
+	}
+
+	//make room for all the shards, then append them
+	int j;
+	for (j=0; ok && j<8; j++) {
+		uint32_t tail = ctx->pool[j].pool_tail;
+		for (t=0; t<threads; t++) {
+			args[t].offset[j] = tail;
+			tail += args[t].shard->pool[j].pool_tail;
+		}
+		if (tail > MAX_INDEX) {
+			ok = 0;
+		} else if (tail > ctx->pool[j].pool_size) {
+			uint32_t unitsize = get_pool_unit_size(j);
+			trieptr pool = (trieptr)wf_realloc(ctx->pool[j].pool, tail * unitsize, ctx->pool[j].pool_size * unitsize);
+			if (!pool) {
+				ok = 0;
+				break;
+			}
+			ctx->pool[j].pool = pool;
+			ctx->pool[j].pool_size = tail;
+		}
+	}
+	if (ok) {
+		for (j=0; j<8; j++) {
+			for (t=0; t<threads; t++) ctx->pool[j].pool_tail += args[t].shard->pool[j].pool_tail;
+		}
+		build_run(args, threads, build_append);
+		for (t=0; t<threads; t++) {
+			for (j=0; j<8; j++) {
+				struct _trie_pool_free_node* freenode;
+				for (freenode=args[t].shard->pool[j].freelist; freenode; freenode=freenode->next)
+					pool_free(ctx->pool, j, args[t].offset[j] + freenode->index + 1);
+			}
+			if (ctx->qgram && args[t].shard->qgram) {
+				for (i=0; i<sizeof(ctx->qgram->bitmap)/sizeof(uint32_t); i++)
+					ctx->qgram->bitmap[i] |= args[t].shard->qgram->bitmap[i];
+				ctx->qgram->lens |= args[t].shard->qgram->lens;
+			} else {
+				qgram_free(ctx->qgram);
+				ctx->qgram = NULL;
+			}
+			ok = ok && args[t].ok;
+		}
+		if (!build_stitch(ctx, args, threads)) ok = 0;
+	}
+
+	for (t=0; t<threads; t++) {
+		if (!args[t].shard) continue;
+		args[t].shard->equiv = NULL;
+		wf_free_ctx(args[t].shard);
+	}
+	if (load) wf_free(load, sizeof(*load) * BUILD_BUCKET_NUM);
+	if (owner) wf_free(owner, BUILD_BUCKET_NUM);
+	if (bucket) wf_free(bucket, sizeof(uint16_t) * num);
+	return ok;
+}
+
+/*
+ * insert many words, the same as inserting them one by one.
+ * an empty context is built by 'threads' threads, otherwise the words are inserted here.
+ * return 0 if some word can't be inserted.
+ */
+int
+wf_insert_words(wordfilterctxptr ctx, const char** words, size_t num, uint16_t category, byte severity, int threads) {
+	if (!ctx || !words || !category) return 0;
+	if (threads > MAX_BUILD_THREAD) threads = MAX_BUILD_THREAD;
+	if (threads > 1 && num > 1 && !ctx->readonly && !ctx->wide && wf_word_isempty(ctx)) {
+		touch_ctx(ctx);
+		return build_parallel(ctx, words, num, trie_make_value(category, severity), threads);
+	}
+	int ok = 1;
+	size_t i;
+	for (i=0; i<num; i++) {
+		if (!wf_insert_word_ex(ctx, words[i], category, severity)) ok = 0;
+	}
+	return ok;
+}
+
+wordfilterctxptr
+wf_create_ctx() {
+	wordfilterctxptr ctx = (wordfilterctxptr)wf_malloc(sizeof(*ctx));
+	if (!ctx) return NULL;
+
+	memset(ctx, 0, sizeof(*ctx));
+	pool_init(ctx->pool);
+
+	ctx->mask_word = '*';
+	ctx->qgram = qgram_create();
+	touch_ctx(ctx);
+	return ctx;
+}
+
+static void shm_release(wordfilterctxptr ctx);
+
+void
+wf_clean_ctx(wordfilterctxptr ctx) {
+	if (!ctx) return;
+	wf_free_ctx(ctx->overlay);
+	equiv_free(ctx->equiv);
+	qgram_free(ctx->qgram);
+	wide_free(ctx->wide);
+	shm_release(ctx);
+	if (!ctx->borrowed)
+		pool_deinit(ctx->pool);
+
+	memset(ctx, 0, sizeof(*ctx));
+	pool_init(ctx->pool);
+	ctx->mask_word = '*';
+	ctx->qgram = qgram_create();
+	touch_ctx(ctx);
+}
+
+//copy a context, e.g. to prepare a new dictionary version from the live one
+wordfilterctxptr
+wf_clone_ctx(wordfilterctxptr ctx) {
+	if (!ctx) return NULL;
+	wordfilterctxptr newctx = (wordfilterctxptr)wf_malloc(sizeof(*newctx));
+	if (!newctx) return NULL;
+
+	*newctx = *ctx;
+	newctx->borrowed = 0;
+	newctx->overlay = NULL;
+	newctx->equiv = NULL;
+	newctx->shm = NULL;
+	newctx->qgram = qgram_clone(ctx->qgram);
+	newctx->wide = NULL;
+	touch_ctx(newctx);
+	if ((ctx->equiv && !(newctx->equiv = equiv_clone(ctx->equiv)))
+		|| (ctx->wide && !(newctx->wide = wide_clone(ctx->wide)))) {
+		equiv_free(newctx->equiv);
+		qgram_free(newctx->qgram);
+		wf_free(newctx, sizeof(*newctx));
+		return NULL;
+	}
+	if (!pool_clone(newctx->pool, ctx->pool)) {
+		pool_deinit(newctx->pool);
+		equiv_free(newctx->equiv);
+		qgram_free(newctx->qgram);
+		wide_free(newctx->wide);
+		wf_free(newctx, sizeof(*newctx));
+		return NULL;
+	}
+	if (ctx->overlay && !(newctx->overlay = wf_clone_ctx(ctx->overlay))) {
+		wf_free_ctx(newctx);
+		return NULL;
+	}
+	return newctx;
+}
+
+//return the bytes reclaimed, the context must not be searched while compacting
+size_t
+wf_compact(wordfilterctxptr ctx) {
+	if (!ctx) return 0;
+	if (ctx->readonly) return wf_compact(ctx->overlay);
+	size_t oldsize = pool_get_memsize(ctx->pool) + wide_get_memsize(ctx->wide);
+	if (!pool_compact(ctx) || !wide_compact(ctx->wide)) return 0;
+	size_t newsize = pool_get_memsize(ctx->pool) + wide_get_memsize(ctx->wide);
+	return oldsize > newsize ? oldsize - newsize : 0;
+}
+
+/*
+ * merge equal suffix subtrees into a DAWG for serving a large fixed dictionary,
+ * search results do not change but the context becomes read only.
+ * return the bytes reclaimed.
+ */
+size_t
+wf_minimize(wordfilterctxptr ctx) {
+	if (!ctx || ctx->readonly || ctx->wide) return 0;
+	size_t oldsize = pool_get_memsize(ctx->pool);
+	if (!pool_minimize(ctx)) return 0;
+	ctx->readonly = 1;
+	size_t newsize = pool_get_memsize(ctx->pool);
+	return oldsize > newsize ? oldsize - newsize : 0;
+}
+
+static void
+dump_static_node(FILE* fp, trieptr node) {
+	fprintf(fp, "{0x%08xu,0x%08xu}", node->data, node->value);
+}
+
+/*
+ * write the context as C source:const pool arrays and a 'struct wf_static_dict' named 'name',
+ * the pools should be compacted or minimized first so that they have no holes.
+ * chain labels are packed into the node words, so the output follows the byte order of the host.
+ */
+int
+wf_dump_static(wordfilterctxptr ctx, const char* name, FILE* fp) {
+	if (!ctx || !name || !fp || ctx->overlay || ctx->wide) return 0;
+	int i;
+	uint32_t j;
+	fprintf(fp, "/* generated by wf_dump_static, do not edit */\n");
+	fprintf(fp, "#include \"word_filter.h\"\n\n");
+	uint32_t equiv_num = 0;
+	if (ctx->equiv) {
+		fprintf(fp, "static const uint32_t %s_equiv[] = {", name);
+		for (j=0; j<0x80; j++) {
+			if (ctx->equiv->ascii[j] == j) continue;
+			fprintf(fp, "%s0x%x,0x%x", equiv_num++ % 8 ? ", " : "\n\t", j, ctx->equiv->ascii[j]);
+		}
+		for (j=0; j<ctx->equiv->num; j++)
+			fprintf(fp, "%s0x%x,0x%x", equiv_num++ % 8 ? ", " : "\n\t", ctx->equiv->pair[j << 1], ctx->equiv->pair[(j << 1) + 1]);
+		fprintf(fp, "\n};\n\n");
+	}
+	for (i=0; i<8; i++) {
+		uint32_t num = ctx->pool[i].pool_tail * (twoto(i+1)-1);
+		if (num == 0) continue;
+		fprintf(fp, "static const struct _trie %s_pool%d[%u] = {\n", name, i, num);
+		for (j=0; j<num; j++) {
+			fprintf(fp, (j % 4 == 0) ? "\t" : " ");
+			dump_static_node(fp, &ctx->pool[i].pool[j]);
+			fprintf(fp, (j % 4 == 3 || j + 1 == num) ? ",\n" : ",");
+		}
+		fprintf(fp, "};\n\n");
+	}
+
+	fprintf(fp, "const struct wf_static_dict %s = {\n\t", name);
+	dump_static_node(fp, &ctx->word_root);
+	fprintf(fp, ",\n\t");
+	dump_static_node(fp, &ctx->skip_word_root);
+	fprintf(fp, ",\n\t%d,\n\t{", ctx->ignorecase);
+	for (i=0; i<8; i++) {
+		if (ctx->pool[i].pool_tail)
+			fprintf(fp, "%s%s_pool%d", i ? ", " : "", name, i);
+		else
+			fprintf(fp, "%sNULL", i ? ", " : "");
+	}
+	fprintf(fp, "},\n\t{");
+	for (i=0; i<8; i++)
+		fprintf(fp, "%s%u", i ? ", " : "", ctx->pool[i].pool_tail);
+	if (ctx->equiv)
+		fprintf(fp, "},\n\t%s_equiv,\n\t%u,\n};\n", name, equiv_num);
+	else
+		fprintf(fp, "},\n\tNULL,\n\t0,\n};\n");
+	return !ferror(fp);
+}
+
+//serve searches from a dictionary compiled in by wf_dump_static, without copying it
+wordfilterctxptr
+wf_open_static(const struct wf_static_dict* dict) {
+	if (!dict) return NULL;
+	wordfilterctxptr ctx = (wordfilterctxptr)wf_malloc(sizeof(*ctx));
+	if (!ctx) return NULL;
+
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->word_root = dict->word_root;
+	ctx->skip_word_root = dict->skip_word_root;
+	ctx->ignorecase = dict->ignorecase;
+	ctx->mask_word = '*';
+	ctx->readonly = 1;
+	ctx->borrowed = 1;
+	touch_ctx(ctx);
+	int i;
+	for (i=0; i<8; i++) {
+		ctx->pool[i].pool = (trieptr)dict->pool[i];
+		ctx->pool[i].pool_size = ctx->pool[i].pool_tail = dict->pool_size[i];
+	}
+	if (dict->equiv_num) {
+		uint32_t j;
+		ctx->equiv = equiv_create();
+		for (j=0; ctx->equiv && j<dict->equiv_num; j++) {
+			if (!equiv_set(ctx->equiv, dict->equiv[j << 1], dict->equiv[(j << 1) + 1])) break;
+		}
+		if (!ctx->equiv || j < dict->equiv_num) {
+			wf_free_ctx(ctx);
+			return NULL;
+		}
+	}
+	ctx->qgram = qgram_build(ctx);
+	return ctx;
+}
+
+#ifndef _WIN32
+/*
+ * shared memory:the builder writes every generation into its own segment "/name.<generation>",
+ * then stores the generation into the header segment "/name". workers map the newest one read only,
+ * an old segment is unlinked at once and lives until the last worker unmaps it.
+ */
+#define SHM_MAGIC 0x48534657 //"WFSH"
+#define SHM_VERSION 1
+#define SHM_NAME_LENGTH 200
+
+struct _shm_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t generation; //0:nothing published yet
+};
+
+struct _shm_image {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t generation;
+	uint64_t size;
+	struct _trie word_root;
+	struct _trie skip_word_root;
+	int32_t ignorecase;
+	uint32_t pool_size[8];
+	uint32_t pool_offset[8]; //from the image start
+	uint32_t equiv_num;
+	uint32_t equiv_offset;
+};
+
+struct _shm_map {
+	struct _shm_header* header;
+	void* image;
+	size_t image_size;
+	uint64_t generation;
+};
+
+static int
+shm_name(char* buf, const char* name, uint64_t generation) {
+	if (!name || !*name || strchr(name, '/') || strlen(name) > SHM_NAME_LENGTH) return 0;
+	if (generation) sprintf(buf, "/%s.%llu", name, (unsigned long long)generation);
+	else sprintf(buf, "/%s", name);
+	return 1;
+}
+
+static struct _shm_header*
+shm_open_header(const char* name, int create) {
+	char path[SHM_NAME_LENGTH + 32];
+	if (!shm_name(path, name, 0)) return NULL;
+	int fd = shm_open(path, create ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+	if (fd < 0) return NULL;
+	struct stat st;
+	if (fstat(fd, &st) < 0 || (st.st_size < (off_t)sizeof(struct _shm_header)
+		&& (!create || ftruncate(fd, sizeof(struct _shm_header)) < 0))) {
+		close(fd);
+		return NULL;
+	}
+	void* p = mmap(NULL, sizeof(struct _shm_header), create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) return NULL;
+	struct _shm_header* header = (struct _shm_header*)p;
+	if (create && header->magic == 0) {
+		header->magic = SHM_MAGIC;
+		header->version = SHM_VERSION;
+	}
+	if (header->magic != SHM_MAGIC || header->version != SHM_VERSION) {
+		munmap(p, sizeof(struct _shm_header));
+		return NULL;
+	}
+	return header;
+}
+
+static void
+shm_unmap(struct _shm_map* shm) {
+	munmap(shm->image, shm->image_size);
+	munmap(shm->header, sizeof(struct _shm_header));
+	wf_free(shm, sizeof(*shm));
+}
+
+static void
+shm_release(wordfilterctxptr ctx) {
+	if (!ctx->shm) return;
+	shm_unmap(ctx->shm);
+	ctx->shm = NULL;
+}
+
+//publish the tries of 'ctx' as the next generation, the words layered on a read only context are not published
+uint64_t
+wf_shm_publish(wordfilterctxptr ctx, const char* name) {
+	if (!ctx || ctx->wide || (ctx->overlay && (!wf_word_isempty(ctx->overlay) || !wf_skipword_isempty(ctx->overlay)))) return 0;
+	struct _shm_header* header = shm_open_header(name, 1);
+	if (!header) return 0;
+	uint64_t generation = __atomic_load_n(&header->generation, __ATOMIC_ACQUIRE) + 1;
+
+	struct _shm_image image;
+	memset(&image, 0, sizeof(image));
+	image.magic = SHM_MAGIC;
+	image.version = SHM_VERSION;
+	image.generation = generation;
+	image.word_root = ctx->word_root;
+	image.skip_word_root = ctx->skip_word_root;
+	image.ignorecase = ctx->ignorecase;
+	size_t size = sizeof(image);
+	int i;
+	for (i=0; i<8; i++) {
+		image.pool_size[i] = ctx->pool[i].pool_tail;
+		image.pool_offset[i] = size;
+		size += ctx->pool[i].pool_tail * get_pool_unit_size(i);
+	}
+	uint32_t j;
+	if (ctx->equiv) {
+		for (j=0; j<0x80; j++)
+			if (ctx->equiv->ascii[j] != j) image.equiv_num++;
+		image.equiv_num += ctx->equiv->num;
+	}
+	image.equiv_offset = size;
+	size += image.equiv_num * sizeof(uint32_t) * 2;
+	image.size = size;
+
+	char path[SHM_NAME_LENGTH + 32];
+	shm_name(path, name, generation);
+	shm_unlink(path); //left by a builder that died before publishing
+	int fd = shm_open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd < 0 || ftruncate(fd, size) < 0) {
+		if (fd >= 0) {close(fd); shm_unlink(path);}
+		munmap(header, sizeof(*header));
+		return 0;
+	}
+	byte* p = (byte*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		shm_unlink(path);
+		munmap(header, sizeof(*header));
+		return 0;
+	}
+	memcpy(p, &image, sizeof(image));
+	for (i=0; i<8; i++) {
+		if (image.pool_size[i])
+			memcpy(p + image.pool_offset[i], ctx->pool[i].pool, image.pool_size[i] * get_pool_unit_size(i));
+	}
+	if (ctx->equiv) {
+		uint32_t* pair = (uint32_t*)(p + image.equiv_offset);
+		for (j=0; j<0x80; j++) {
+			if (ctx->equiv->ascii[j] == j) continue;
+			*pair++ = j;
+			*pair++ = ctx->equiv->ascii[j];
+		}
+		if (ctx->equiv->num)
+			memcpy(pair, ctx->equiv->pair, ctx->equiv->num * sizeof(uint32_t) * 2);
+	}
+	munmap(p, size);
+
+	__atomic_store_n(&header->generation, generation, __ATOMIC_RELEASE);
+	munmap(header, sizeof(*header));
+	if (generation > 1 && shm_name(path, name, generation - 1))
+		shm_unlink(path);
+	return generation;
+}
+
+//map the newest generation, the context is read only like wf_open_static
+wordfilterctxptr
+wf_shm_attach(const char* name) {
+	struct _shm_header* header = shm_open_header(name, 0);
+	if (!header) return NULL;
+	char path[SHM_NAME_LENGTH + 32];
+	uint64_t generation = 0;
+	int fd = -1;
+	//the generation may be replaced between reading it and opening it
+	while (fd < 0) {
+		uint64_t newest = __atomic_load_n(&header->generation, __ATOMIC_ACQUIRE);
+		if (newest == 0 || newest == generation) break;
+		generation = newest;
+		shm_name(path, name, generation);
+		fd = shm_open(path, O_RDONLY, 0);
+		if (fd < 0 && errno != ENOENT) break;
+	}
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(struct _shm_image)) {
+		if (fd >= 0) close(fd);
+		munmap(header, sizeof(*header));
+		return NULL;
+	}
+	size_t size = st.st_size;
+	void* p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		munmap(header, sizeof(*header));
+		return NULL;
+	}
+
+	const struct _shm_image* image = (const struct _shm_image*)p;
+	struct wf_static_dict dict;
+	int i, ok = image->magic == SHM_MAGIC && image->version == SHM_VERSION && image->size == size
+		&& image->equiv_offset + (uint64_t)image->equiv_num * sizeof(uint32_t) * 2 <= size;
+	for (i=0; i<8 && ok; i++) {
+		ok = image->pool_offset[i] + (uint64_t)image->pool_size[i] * get_pool_unit_size(i) <= size;
+		dict.pool[i] = image->pool_size[i] ? (const struct _trie*)((byte*)p + image->pool_offset[i]) : NULL;
+		dict.pool_size[i] = image->pool_size[i];
+	}
+	struct _shm_map* shm = ok ? (struct _shm_map*)wf_malloc(sizeof(*shm)) : NULL;
+	if (!shm) {
+		munmap(p, size);
+		munmap(header, sizeof(*header));
+		return NULL;
+	}
+	shm->header = header;
+	shm->image = p;
+	shm->image_size = size;
+	shm->generation = generation;
+
+	dict.word_root = image->word_root;
+	dict.skip_word_root = image->skip_word_root;
+	dict.ignorecase = image->ignorecase;
+	dict.equiv = (const uint32_t*)((byte*)p + image->equiv_offset);
+	dict.equiv_num = image->equiv_num;
+	wordfilterctxptr ctx = wf_open_static(&dict);
+	if (!ctx) {
+		shm_unmap(shm);
+		return NULL;
+	}
+	ctx->shm = shm;
+	return ctx;
+}
+
+//remove the published dictionary, the attached workers keep their mappings
+int
+wf_shm_unlink(const char* name) {
+	char path[SHM_NAME_LENGTH + 32];
+	struct _shm_header* header = shm_open_header(name, 0);
+	if (!header) return 0;
+	uint64_t generation = __atomic_load_n(&header->generation, __ATOMIC_ACQUIRE);
+	munmap(header, sizeof(*header));
+	if (generation && shm_name(path, name, generation))
+		shm_unlink(path);
+	shm_name(path, name, 0);
+	return shm_unlink(path) == 0;
+}
+
+//a newer generation is published, attach again to pick it up
+int
+wf_shm_stale(wordfilterctxptr ctx) {
+	if (!ctx || !ctx->shm) return 0;
+	return __atomic_load_n(&ctx->shm->header->generation, __ATOMIC_ACQUIRE) != ctx->shm->generation;
+}
+#else
+static void
+shm_release(wordfilterctxptr ctx) {}
+#endif
+
+void wf_free_ctx(wordfilterctxptr ctx) {
+	if (!ctx) return;
+
+	wf_free_ctx(ctx->overlay);
+	equiv_free(ctx->equiv);
+	qgram_free(ctx->qgram);
+	wide_free(ctx->wide);
+	shm_release(ctx);
+	if (!ctx->borrowed)
+		pool_deinit(ctx->pool);
+	wf_free(ctx, sizeof(*ctx));
+}
+
+int
+wf_search_word(wordfilterctxptr ctx, const char* word, char* word_key) {
+	int allow = 0;
+	int ret = search_word(ctx, word, word, word_key, WF_CATEGORY_ALL, NULL, &allow, NULL, NULL);
+	if (ret && ret <= allow) {
+		if (word_key) word_key[0] = 0;
+		return 0;
+	}
+	return ret;
+}
+
+int
+wf_search_word_ex(wordfilterctxptr ctx, const char* word, strnodeptr* strlist) {
+	return wf_search_word_category(ctx, word, WF_CATEGORY_ALL, strlist, NULL);
+}
+
+//hitmask:union of the categories of all matched words
+int
+wf_search_word_category(wordfilterctxptr ctx, const char* word, uint32_t catmask, strnodeptr* strlist, uint32_t* hitmask) {
+	return wf_search_word_budget(ctx, word, catmask, strlist, hitmask, ctx ? ctx->budget : 0);
+}
+
+int
+wf_search_word_budget(wordfilterctxptr ctx, const char* word, uint32_t catmask, strnodeptr* strlist, uint32_t* hitmask,
+	uint32_t budget) {
+	const char* wordptr = word;
+	const char* allow_end = word; //the end of the allowed words seen so far
+	const char* valid_end = scan_valid_end(ctx, word);
+	int find = 0;
+	uint32_t hit = 0;
+	uint32_t* budgetptr = budget ? &budget : NULL;
+	strnodeptr strnode = NULL;
+	while (*wordptr) {
+		if (!may_match(ctx, wordptr)) {
+			wordptr += scan_step(wordptr, valid_end);
+			continue;
+		}
+		char word_key[MAX_WORD_LENGTH + 1] = {0};
+		uint32_t value = 0;
+		int allow = 0;
+		int ret = search_word(ctx, word, wordptr, word_key, catmask, &value, &allow, budgetptr, NULL);
+		if (wordptr + allow > allow_end) allow_end = wordptr + allow;
+		if (ret && wordptr + ret > allow_end) {
+			find = 1; 
+			wordptr += ret;
+			hit |= value_get_category(value) & catmask;
+			if (strlist && !search_strnode(strnode, word_key))
+				strnode = insert_str(strnode, word_key, value);
+		}
+		else {
+			wordptr += scan_step(wordptr, valid_end);
+		}
+		//a match completed before the budget ran out is kept
+		if (budgetptr && budget == 0) break;
+	}
+	if (strlist)
+		*strlist = strnode;
+	if (hitmask)
+		*hitmask = hit;
+
+	return budgetptr && budget == 0 ? WF_BUDGET_EXCEEDED : find;
+}
+
+static int
+_fill_outstr(const char* wordptr, char* outstr, const char* word_key, int len, char mask_word) {
 	int index = 0, i = 0, strpos = 0, n;
 	while (i < len) {
 		char c = *(wordptr + i);
-		if (word_key[index] == c) {//is skip word?
-			outstr[strpos++] = mask_word;
+		if (word_key[index] == c) {//is skip word?
+			outstr[strpos++] = mask_word;
+			n = get_utf8_size(c);
+			index += n;  i += n;
+		} else {
+			outstr[strpos++] = c;
+			i++;
+		}
+	}
+	return strpos;
+}
+
+int
+wf_filter_word(wordfilterctxptr ctx, const char* word, strnodeptr* strlist, char* outstr) {
+	return wf_filter_word_category(ctx, word, WF_CATEGORY_ALL, strlist, outstr, NULL);
+}
+
+//only words in 'catmask' are masked and reported
+int
+wf_filter_word_category(wordfilterctxptr ctx, const char* word, uint32_t catmask, strnodeptr* strlist, char* outstr, uint32_t* hitmask) {
+	return wf_filter_word_budget(ctx, word, catmask, strlist, outstr, hitmask, ctx ? ctx->budget : 0);
+}
+
+int
+wf_filter_word_budget(wordfilterctxptr ctx, const char* word, uint32_t catmask, strnodeptr* strlist, char* outstr, uint32_t* hitmask,
+	uint32_t budget) {
+	if (!ctx || !word || !outstr) return 0;
+	const char* wordptr = word;
+	const char* allow_end = word;
+	const char* valid_end = scan_valid_end(ctx, word);
+	char mask_word = ctx->mask_word;
+	int find = 0, strpos = 0, n;
+	uint32_t hit = 0;
+	uint32_t* budgetptr = budget ? &budget : NULL;
+
+	strnodeptr strnode = NULL;
+	while (*wordptr) {
+		if (!may_match(ctx, wordptr)) {
+			n = scan_step(wordptr, valid_end);
+			memcpy(outstr + strpos, wordptr, n);
+			strpos += n;  wordptr += n;
+			continue;
+		}
+		char word_key[MAX_WORD_LENGTH + 1] = {0};
+		uint32_t value = 0;
+		int allow = 0;
+		int ret = search_word(ctx, word, wordptr, word_key, catmask, &value, &allow, budgetptr, NULL);
+		if (wordptr + allow > allow_end) allow_end = wordptr + allow;
+		if (ret && wordptr + ret > allow_end) {
+			find = 1;
+			strpos += _fill_outstr(wordptr, outstr + strpos, word_key, ret, mask_word);
+			wordptr += ret;
+			hit |= value_get_category(value) & catmask;
+
+			if (strlist && !search_strnode(strnode, word_key))
+				strnode = insert_str(strnode, word_key, value);
+		}
+		else {
+			n = scan_step(wordptr, valid_end);
+			memcpy(outstr + strpos, wordptr, n);
+			strpos += n;  wordptr += n;
+		}
+		if (budgetptr && budget == 0) break;
+	}
+
+	if (budgetptr && budget == 0) {
+		//the rest is not scanned
+		n = strlen(wordptr);
+		memcpy(outstr + strpos, wordptr, n);
+		strpos += n;
+		find = WF_BUDGET_EXCEEDED;
+	}
+	if (strlist) {
+		*strlist = strnode;
+	}
+	if (hitmask)
+		*hitmask = hit;
+	outstr[strpos] = '\0';
+	return find;
+}
+
+static int
+span_add(struct wf_span_list* spans, uint32_t start, uint32_t end) {
+	if (spans->num && spans->span[(spans->num << 1) - 1] == start) {
+		spans->span[(spans->num << 1) - 1] = end;
+		return 1;
+	}
+	if (spans->num == spans->size) {
+		uint32_t newsize = spans->size ? spans->size << 1 : 16;
+		uint32_t* span = (uint32_t*)wf_realloc(spans->span, sizeof(uint32_t) * 2 * newsize, sizeof(uint32_t) * 2 * spans->size);
+		if (!span) return 0;
+		spans->span = span;
+		spans->size = newsize;
+	}
+	spans->span[spans->num << 1] = start;
+	spans->span[(spans->num << 1) + 1] = end;
+	spans->num++;
+	return 1;
+}
+
+//the bytes _fill_outstr masks, 'offset' is the position of 'wordptr' in the text
+static int
+_fill_span(struct wf_span_list* spans, uint32_t offset, const char* wordptr, const char* word_key, int len) {
+	int index = 0, i = 0, n;
+	while (i < len) {
+		char c = *(wordptr + i);
+		if (word_key[index] == c) {
 			n = get_utf8_size(c);
+			if (!span_add(spans, offset + i, offset + (i + n < len ? i + n : len))) return 0;
 			index += n;  i += n;
 		} else {
-			outstr[strpos++] = c;
 			i++;
 		}
 	}
-	return strpos;
+	return 1;
 }
 
+/*
+ * like wf_filter_word_category, but only the merged ranges to mask are returned, the skipped bytes are not in them.
+ * 'spans' starts as {0} and can be reused by the next calls, free it by wf_free_span_list.
+ * return -1 if out of memory, WF_BUDGET_EXCEEDED with the spans found so far.
+ */
 int
-wf_filter_word(wordfilterctxptr ctx, const char* word, strnodeptr* strlist, char* outstr) {
-	if (!ctx || !word || !outstr) return 0;
+wf_filter_span(wordfilterctxptr ctx, const char* word, uint32_t catmask, struct wf_span_list* spans, uint32_t* hitmask) {
+	return wf_filter_span_budget(ctx, word, catmask, spans, hitmask, ctx ? ctx->budget : 0);
+}
+
+int
+wf_filter_span_budget(wordfilterctxptr ctx, const char* word, uint32_t catmask, struct wf_span_list* spans, uint32_t* hitmask,
+	uint32_t budget) {
+	if (!ctx || !word || !spans) return 0;
 	const char* wordptr = word;
-	char mask_word = ctx->mask_word;
-	int find = 0, strpos = 0;
+	const char* allow_end = word;
+	const char* valid_end = scan_valid_end(ctx, word);
+	int find = 0;
+	uint32_t hit = 0;
+	uint32_t* budgetptr = budget ? &budget : NULL;
 
-	strnodeptr strnode = NULL;
+	spans->num = 0;
 	while (*wordptr) {
+		if (!may_match(ctx, wordptr)) {
+			wordptr += scan_step(wordptr, valid_end);
+			continue;
+		}
 		char word_key[MAX_WORD_LENGTH + 1] = {0};
-		int ret = wf_search_word(ctx, wordptr, word_key);
-		if (ret) {
+		uint32_t value = 0;
+		int allow = 0;
+		int ret = search_word(ctx, word, wordptr, word_key, catmask, &value, &allow, budgetptr, NULL);
+		if (wordptr + allow > allow_end) allow_end = wordptr + allow;
+		if (ret && wordptr + ret > allow_end) {
 			find = 1;
-			strpos += _fill_outstr(wordptr, outstr + strpos, word_key, ret, mask_word);
+			if (!_fill_span(spans, wordptr - word, wordptr, word_key, ret)) return -1;
 			wordptr += ret;
-
-			if (strlist && !search_strnode(strnode, word_key))
-				strnode = insert_str(strnode, word_key);
+			hit |= value_get_category(value) & catmask;
 		}
 		else {
-			outstr[strpos++] = *wordptr;
-			wordptr++;
+			wordptr += scan_step(wordptr, valid_end);
 		}
+		if (budgetptr && budget == 0) break;
 	}
 
-	if (strlist) {
-		*strlist = strnode;
-	}
-	outstr[strpos] = '\0';
-	return find;
+	if (hitmask)
+		*hitmask = hit;
+	return budgetptr && budget == 0 ? WF_BUDGET_EXCEEDED : find;
+}
+
+void
+wf_free_span_list(struct wf_span_list* spans) {
+	if (!spans) return;
+	if (spans->span) wf_free(spans->span, sizeof(uint32_t) * 2 * spans->size);
+	memset(spans, 0, sizeof(*spans));
 }
 
 //this function must be used before the 'wf_insert_word'
 void
 wf_set_ignore_case(wordfilterctxptr ctx, int is_ignore) {
 	ctx->ignorecase = is_ignore;
+	touch_ctx(ctx);
+}
+
+/*
+ * code point mode for CJK heavy dictionaries, it must be used before the 'wf_insert_word'.
+ * patterns, wf_minimize, wf_dump_static and wf_shm_publish need the byte mode.
+ */
+int
+wf_set_codepoint(wordfilterctxptr ctx, int enable) {
+	if (!ctx || ctx->readonly || !wf_word_isempty(ctx)) return 0;
+	touch_ctx(ctx);
+	if (!enable) {
+		wide_free(ctx->wide);
+		ctx->wide = NULL;
+		return 1;
+	}
+	return ctx->wide || (ctx->wide = wide_create());
+}
+
+/*
+ * the scans try the words only at character starts, the text is validated once per call,
+ * from the first invalid sequence on they step by bytes as before.
+ */
+void
+wf_set_utf8(wordfilterctxptr ctx, int enable) {
+	ctx->utf8 = enable;
+	touch_ctx(ctx);
+}
+
+/*
+ * limit the trie steps of one scan call(search, filter, span, count), 0:no limit.
+ * a step is a character or a skip word walked in the trie from some start position, so a scan costs about
+ * the text length when few words start in it. when the steps run out the call stops and returns
+ * WF_BUDGET_EXCEEDED:the results found so far are filled, filter copies the rest of the text unmasked.
+ */
+void
+wf_set_budget(wordfilterctxptr ctx, uint32_t budget) {
+	ctx->budget = budget;
+	touch_ctx(ctx);
 }
 
 void
 wf_set_mask_word(wordfilterctxptr ctx, char mask_word) {
 	ctx->mask_word = mask_word;
+	touch_ctx(ctx);
+}
+
+/*
+ * the match at 'word' inside the text 'begin'(for boundaries), for the scan loops outside(word_filter.hpp).
+ * word_key:WF_MAX_WORD_LENGTH+1 bytes or NULL, allow:the length of the longest allowed word at 'word'.
+ */
+int
+wf_match_at(wordfilterctxptr ctx, const char* begin, const char* word, char* word_key,
+	uint32_t catmask, uint32_t* value, int* allow) {
+	if (allow) *allow = 0;
+	return search_word(ctx, begin, word, word_key, catmask, value, allow, NULL, NULL);
+}
+
+/*
+ * every character of 'variants' matches as 'canonical'(one character), e.g. ("a", "@4а").
+ * the classes apply to words and skip words, they must be added before inserting:
+ * the words already in the tries keep the old canonical bytes, so it fails then.
+ */
+int
+wf_add_equiv(wordfilterctxptr ctx, const char* canonical, const char* variants) {
+	if (!ctx || !canonical || !variants || ctx->readonly) return 0;
+	if (!wf_word_isempty(ctx) || !wf_skipword_isempty(ctx)) return 0;
+	touch_ctx(ctx);
+	uint32_t to, from;
+	int n = utf8_decode(canonical, &to);
+	if (!*canonical || canonical[n] || (to & UTF8_INVALID)) return 0;
+	if (ctx->ignorecase && to < 0x80) to = wf_tolower(to);
+
+	if (!ctx->equiv && !(ctx->equiv = equiv_create())) return 0;
+	while (*variants) {
+		variants += utf8_decode(variants, &from);
+		if (from & UTF8_INVALID) return 0;
+		if (ctx->ignorecase && from < 0x80) from = wf_tolower(from);
+		if (from == to) continue;
+		if (!equiv_set(ctx->equiv, from, to)) return 0;
+	}
+	return 1;
+}
+
+/*
+ * big reader lock:a reader only writes the slot of its thread(a cache line of its own) and checks the writer flag,
+ * so the readers of a context don't slow each other down. a writer sets the flag, then waits for the slots to drain.
+ * writers are rare and pay for the readers. read locks don't nest.
+ */
+#define MAX_READER 256
+
+struct _reader_slot {
+	uint32_t active;
+	char pad[64 - sizeof(uint32_t)];
+};
+
+struct wf_brlock {
+	struct _reader_slot slot[MAX_READER];
+	uint32_t overflow; //readers of the threads beyond MAX_READER
+	int writer;
+	pthread_mutex_t mutex;
+};
+
+static uint32_t g_reader_used[MAX_READER / 32]; //the slots taken by living threads
+static uint32_t g_reader_num = 0; //the slots ever taken, what a writer scans
+static pthread_key_t g_reader_key;
+static pthread_once_t g_reader_once = PTHREAD_ONCE_INIT;
+static __thread int t_reader = -1; //the slot of this thread, -2:none left
+
+static void
+reader_exit(void* p) {
+	int index = (int)(intptr_t)p - 1;
+	__atomic_and_fetch(&g_reader_used[index >> 5], ~(1u << (index & 31)), __ATOMIC_SEQ_CST);
+}
+
+static void
+reader_key_create() {
+	pthread_key_create(&g_reader_key, reader_exit);
+}
+
+static int
+reader_index() {
+	if (t_reader != -1) return t_reader;
+	pthread_once(&g_reader_once, reader_key_create);
+	t_reader = -2;
+	int i;
+	for (i=0; i<MAX_READER && t_reader < 0; i++) {
+		uint32_t* used = &g_reader_used[i >> 5];
+		uint32_t bits = __atomic_load_n(used, __ATOMIC_RELAXED);
+		while (!(bits & (1u << (i & 31)))) {
+			if (__atomic_compare_exchange_n(used, &bits, bits | (1u << (i & 31)), 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+				t_reader = i;
+				break;
+			}
+		}
+	}
+	if (t_reader < 0) return t_reader;
+	pthread_setspecific(g_reader_key, (void*)(intptr_t)(t_reader + 1));
+	uint32_t num = __atomic_load_n(&g_reader_num, __ATOMIC_SEQ_CST);
+	while (num < (uint32_t)t_reader + 1 &&
+		!__atomic_compare_exchange_n(&g_reader_num, &num, t_reader + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+	return t_reader;
+}
+
+struct wf_brlock*
+wf_brlock_create() {
+	struct wf_brlock* lock = (struct wf_brlock*)wf_malloc(sizeof(*lock));
+	if (!lock) return NULL;
+	memset(lock, 0, sizeof(*lock));
+	pthread_mutex_init(&lock->mutex, NULL);
+	return lock;
+}
+
+void
+wf_brlock_free(struct wf_brlock* lock) {
+	if (!lock) return;
+	pthread_mutex_destroy(&lock->mutex);
+	wf_free(lock, sizeof(*lock));
+}
+
+void
+wf_brlock_rlock(struct wf_brlock* lock) {
+	int index = reader_index();
+	uint32_t* active = index >= 0 ? &lock->slot[index].active : &lock->overflow;
+	for (;;) {
+		if (index >= 0) __atomic_store_n(active, 1, __ATOMIC_RELAXED);
+		else __atomic_add_fetch(active, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (!__atomic_load_n(&lock->writer, __ATOMIC_ACQUIRE)) return;
+		//a writer is waiting, let it go first
+		if (index >= 0) __atomic_store_n(active, 0, __ATOMIC_RELEASE);
+		else __atomic_sub_fetch(active, 1, __ATOMIC_RELEASE);
+		while (__atomic_load_n(&lock->writer, __ATOMIC_ACQUIRE)) sched_yield();
+	}
+}
+
+void
+wf_brlock_runlock(struct wf_brlock* lock) {
+	if (t_reader >= 0) __atomic_store_n(&lock->slot[t_reader].active, 0, __ATOMIC_RELEASE);
+	else __atomic_sub_fetch(&lock->overflow, 1, __ATOMIC_RELEASE);
+}
+
+void
+wf_brlock_wlock(struct wf_brlock* lock) {
+	pthread_mutex_lock(&lock->mutex);
+	__atomic_store_n(&lock->writer, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	uint32_t i, num = __atomic_load_n(&g_reader_num, __ATOMIC_SEQ_CST);
+	for (i=0; i<num; i++)
+		while (__atomic_load_n(&lock->slot[i].active, __ATOMIC_ACQUIRE)) sched_yield();
+	while (__atomic_load_n(&lock->overflow, __ATOMIC_ACQUIRE)) sched_yield();
+}
+
+void
+wf_brlock_wunlock(struct wf_brlock* lock) {
+	__atomic_store_n(&lock->writer, 0, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&lock->mutex);
+}
+
+/*
+ * result cache:repeated messages reuse the result of wf_search_word_category/wf_filter_word_category.
+ * an entry is found by the hash of the text and checked by the text itself, the context generation
+ * and the catmask, so a change of the context makes its entries miss. CLOCK eviction.
+ * a cache is not thread safe, use one per thread or lock it.
+ */
+#define CACHE_MAX_TEXT 4096 //longer texts are not cached
+
+struct _cache_entry {
+	uint64_t hash;
+	uint64_t generation;
+	uint32_t catmask;
+	uint32_t len;       //text length
+	byte filter;        //filter or search result
+	byte ref;           //CLOCK reference bit
+	int find;
+	uint32_t hitmask;
+	uint32_t word_num;
+	size_t size;
+	char* blob;         //text\0 outstr\0 (category(2) severity(1) word\0)...
+	int32_t next;       //next entry in the bucket
+};
+
+struct wf_cache {
+	uint32_t size;
+	uint32_t hand;
+	int32_t* bucket;    //bucket number is the entry number
+	struct _cache_entry* entry;
+	uint64_t hit;
+	uint64_t miss;
+};
+
+static inline uint64_t
+cache_hash(const char* str, size_t len) {
+	uint64_t hash = 14695981039346656037ULL;
+	size_t i;
+	for (i=0; i<len; i++) {
+		hash ^= (byte)str[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+struct wf_cache*
+wf_cache_create(uint32_t size) {
+	if (size == 0) return NULL;
+	struct wf_cache* cache = (struct wf_cache*)wf_malloc(sizeof(*cache));
+	if (!cache) return NULL;
+	memset(cache, 0, sizeof(*cache));
+	cache->size = size;
+	cache->bucket = (int32_t*)wf_malloc(sizeof(int32_t) * size);
+	cache->entry = (struct _cache_entry*)wf_malloc(sizeof(struct _cache_entry) * size);
+	if (!cache->bucket || !cache->entry) {
+		wf_cache_free(cache);
+		return NULL;
+	}
+	memset(cache->bucket, 0xFF, sizeof(int32_t) * size);
+	memset(cache->entry, 0, sizeof(struct _cache_entry) * size);
+	return cache;
+}
+
+void
+wf_cache_free(struct wf_cache* cache) {
+	if (!cache) return;
+	uint32_t i;
+	if (cache->entry) {
+		for (i=0; i<cache->size; i++) {
+			if (cache->entry[i].blob)
+				wf_free(cache->entry[i].blob, cache->entry[i].size);
+		}
+		wf_free(cache->entry, sizeof(struct _cache_entry) * cache->size);
+	}
+	if (cache->bucket)
+		wf_free(cache->bucket, sizeof(int32_t) * cache->size);
+	wf_free(cache, sizeof(*cache));
+}
+
+void
+wf_cache_stat(struct wf_cache* cache, uint64_t* hit, uint64_t* miss) {
+	if (hit) *hit = cache ? cache->hit : 0;
+	if (miss) *miss = cache ? cache->miss : 0;
+}
+
+static struct _cache_entry*
+cache_find(struct wf_cache* cache, wordfilterctxptr ctx, const char* word, size_t len, uint64_t hash,
+	uint32_t catmask, int filter) {
+	int32_t i = cache->bucket[hash % cache->size];
+	while (i >= 0) {
+		struct _cache_entry* entry = &cache->entry[i];
+		if (entry->hash == hash && entry->len == len && entry->generation == ctx->generation
+			&& entry->catmask == catmask && entry->filter == filter && memcmp(entry->blob, word, len) == 0)
+			return entry;
+		i = entry->next;
+	}
+	return NULL;
+}
+
+static void
+cache_store(struct wf_cache* cache, wordfilterctxptr ctx, const char* word, size_t len, uint64_t hash,
+	uint32_t catmask, int find, const char* outstr, strnodeptr strlist, uint32_t hitmask) {
+	size_t outlen = outstr ? strlen(outstr) : 0;
+	size_t size = len + 1 + outlen + 1;
+	uint32_t word_num = 0;
+	strnodeptr node;
+	for (node=strlist; node; node=node->next, word_num++)
+		size += 3 + strlen(node->str) + 1;
+	char* blob = (char*)wf_malloc(size);
+	if (!blob) return;
+
+	//the victim:the first entry from the hand without the reference bit
+	struct _cache_entry* entry;
+	while ((entry = &cache->entry[cache->hand])->ref) {
+		entry->ref = 0;
+		cache->hand = (cache->hand + 1) % cache->size;
+	}
+	int32_t index = cache->hand;
+	cache->hand = (cache->hand + 1) % cache->size;
+	if (entry->blob) {
+		int32_t* prev = &cache->bucket[entry->hash % cache->size];
+		while (*prev != index) prev = &cache->entry[*prev].next;
+		*prev = entry->next;
+		wf_free(entry->blob, entry->size);
+	}
+
+	char* p = blob;
+	memcpy(p, word, len);
+	p[len] = '\0';
+	p += len + 1;
+	memcpy(p, outstr ? outstr : "", outlen + 1);
+	p += outlen + 1;
+	for (node=strlist; node; node=node->next) {
+		p[0] = node->category & 0xFF;
+		p[1] = node->category >> 8;
+		p[2] = node->severity;
+		strcpy(p + 3, node->str);
+		p += 3 + strlen(node->str) + 1;
+	}
+
+	entry->hash = hash;
+	entry->generation = ctx->generation;
+	entry->catmask = catmask;
+	entry->len = len;
+	entry->filter = outstr != NULL;
+	entry->ref = 0;
+	entry->find = find;
+	entry->hitmask = hitmask;
+	entry->word_num = word_num;
+	entry->size = size;
+	entry->blob = blob;
+	entry->next = cache->bucket[hash % cache->size];
+	cache->bucket[hash % cache->size] = index;
+}
+
+static strnodeptr
+cache_strlist(struct _cache_entry* entry) {
+	const char* p = entry->blob + entry->len + 1;
+	p += strlen(p) + 1;
+	strnodeptr head = NULL, tail = NULL;
+	uint32_t i;
+	for (i=0; i<entry->word_num; i++) {
+		uint16_t category = (byte)p[0] | ((byte)p[1] << 8);
+		strnodeptr node = insert_str(NULL, p + 3, trie_make_value(category, (byte)p[2]));
+		if (!node) break;
+		if (tail) tail->next = node;
+		else head = node;
+		tail = node;
+		p += 3 + strlen(p + 3) + 1;
+	}
+	return head;
+}
+
+/*
+ * the two halves of wf_cache_search_word/wf_cache_filter_word(outstr NULL:search), so a cache shared by threads
+ * is locked only around them and the scan of a miss runs unlocked. the context must not change in between.
+ * lookup returns WF_CACHE_MISS or the result, store adds the result of the scan.
+ */
+int
+wf_cache_lookup(struct wf_cache* cache, wordfilterctxptr ctx, const char* word, uint32_t catmask,
+	strnodeptr* strlist, char* outstr, uint32_t* hitmask) {
+	if (!cache || !ctx || !word) return WF_CACHE_MISS;
+	size_t len = strlen(word);
+	if (len > CACHE_MAX_TEXT) return WF_CACHE_MISS;
+	struct _cache_entry* entry = cache_find(cache, ctx, word, len, cache_hash(word, len), catmask, outstr != NULL);
+	if (!entry) {
+		cache->miss++;
+		return WF_CACHE_MISS;
+	}
+	cache->hit++;
+	entry->ref = 1;
+	if (outstr) strcpy(outstr, entry->blob + len + 1);
+	if (strlist) *strlist = cache_strlist(entry);
+	if (hitmask) *hitmask = entry->hitmask;
+	return entry->find;
+}
+
+void
+wf_cache_store(struct wf_cache* cache, wordfilterctxptr ctx, const char* word, uint32_t catmask,
+	int find, strnodeptr strlist, const char* outstr, uint32_t hitmask) {
+	if (!cache || !ctx || !word) return;
+	size_t len = strlen(word);
+	if (len > CACHE_MAX_TEXT) return;
+	cache_store(cache, ctx, word, len, cache_hash(word, len), catmask, find, outstr, strlist, hitmask);
+}
+
+static int
+cache_word(struct wf_cache* cache, wordfilterctxptr ctx, const char* word, uint32_t catmask,
+	strnodeptr* strlist, char* outstr, uint32_t* hitmask) {
+	int find = wf_cache_lookup(cache, ctx, word, catmask, strlist, outstr, hitmask);
+	if (find != WF_CACHE_MISS) return find;
+	strnodeptr list = NULL;
+	uint32_t hit = 0;
+	find = outstr ? wf_filter_word_category(ctx, word, catmask, &list, outstr, &hit)
+		: wf_search_word_category(ctx, word, catmask, &list, &hit);
+	wf_cache_store(cache, ctx, word, catmask, find, list, outstr, hit);
+	if (strlist) *strlist = list;
+	else wf_free_str_list(list);
+	if (hitmask) *hitmask = hit;
+	return find;
+}
+
+//wf_search_word_category through the cache
+int
+wf_cache_search_word(struct wf_cache* cache, wordfilterctxptr ctx, const char* word, uint32_t catmask,
+	strnodeptr* strlist, uint32_t* hitmask) {
+	if (!ctx || !word) return 0;
+	return cache_word(cache, ctx, word, catmask, strlist, NULL, hitmask);
+}
+
+//wf_filter_word_category through the cache
+int
+wf_cache_filter_word(struct wf_cache* cache, wordfilterctxptr ctx, const char* word, uint32_t catmask,
+	strnodeptr* strlist, char* outstr, uint32_t* hitmask) {
+	if (!ctx || !word || !outstr) return 0;
+	return cache_word(cache, ctx, word, catmask, strlist, outstr, hitmask);
+}
+
+/*
+ * hit counting for corpus analytics:every match in the scan of wf_count_word adds one to its dictionary word
+ * (the matched characters made canonical, a pattern gap is written as in the pattern, so every filler is one word).
+ * the counts are kept by the word instead of the trie node, the end nodes are shared by
+ * wf_minimize and layered contexts have two tries. a counter is not thread safe,
+ * count with one per thread and wf_counter_merge them at the end.
+ */
+struct _count_entry {
+	uint64_t hash;
+	char* word;        //NULL:empty slot
+	uint64_t count;
+	uint32_t value;    //category | severity of the word
+};
+
+struct wf_counter {
+	struct _count_entry* entry;
+	uint32_t size;     //power of 2
+	uint32_t num;
+	uint64_t total;    //all matches
+};
+
+struct wf_counter*
+wf_counter_create() {
+	struct wf_counter* counter = (struct wf_counter*)wf_malloc(sizeof(*counter));
+	if (!counter) return NULL;
+	memset(counter, 0, sizeof(*counter));
+	counter->size = 256;
+	counter->entry = (struct _count_entry*)wf_malloc(sizeof(struct _count_entry) * counter->size);
+	if (!counter->entry) {
+		wf_free(counter, sizeof(*counter));
+		return NULL;
+	}
+	memset(counter->entry, 0, sizeof(struct _count_entry) * counter->size);
+	return counter;
+}
+
+void
+wf_counter_free(struct wf_counter* counter) {
+	if (!counter) return;
+	uint32_t i;
+	for (i=0; i<counter->size; i++)
+		if (counter->entry[i].word) wf_free(counter->entry[i].word, strlen(counter->entry[i].word) + 1);
+	wf_free(counter->entry, sizeof(struct _count_entry) * counter->size);
+	wf_free(counter, sizeof(*counter));
+}
+
+static struct _count_entry*
+counter_find(struct wf_counter* counter, const char* word, uint64_t hash) {
+	uint32_t mask = counter->size - 1, i = (uint32_t)hash & mask;
+	while (counter->entry[i].word) {
+		if (counter->entry[i].hash == hash && strcmp(counter->entry[i].word, word) == 0) break;
+		i = (i + 1) & mask;
+	}
+	return &counter->entry[i];
+}
+
+static int
+counter_rehash(struct wf_counter* counter) {
+	uint32_t newsize = counter->size << 1, i;
+	struct _count_entry* entry = (struct _count_entry*)wf_malloc(sizeof(struct _count_entry) * newsize);
+	if (!entry) return 0;
+	memset(entry, 0, sizeof(struct _count_entry) * newsize);
+	for (i=0; i<counter->size; i++) {
+		struct _count_entry* e = &counter->entry[i];
+		if (!e->word) continue;
+		uint32_t j = (uint32_t)e->hash & (newsize - 1);
+		while (entry[j].word) j = (j + 1) & (newsize - 1);
+		entry[j] = *e;
+	}
+	wf_free(counter->entry, sizeof(struct _count_entry) * counter->size);
+	counter->entry = entry;
+	counter->size = newsize;
+	return 1;
+}
+
+static int
+counter_add(struct wf_counter* counter, const char* word, uint32_t value, uint64_t count) {
+	size_t len = strlen(word);
+	uint64_t hash = cache_hash(word, len);
+	struct _count_entry* e = counter_find(counter, word, hash);
+	if (!e->word) {
+		//load factor 3/4
+		if ((counter->num + 1) * 4 > counter->size * 3) {
+			if (!counter_rehash(counter)) return 0;
+			e = counter_find(counter, word, hash);
+		}
+		if (!(e->word = (char*)wf_malloc(len + 1))) return 0;
+		memcpy(e->word, word, len + 1);
+		e->hash = hash;
+		e->value = value;
+		counter->num++;
+	}
+	e->count += count;
+	counter->total += count;
+	return 1;
+}
+
+//the word as it is inserted:lower case, equivalence classes folded, a gap as '?' or '{m,n}'
+static void
+canonical_key(wordfilterctxptr ctx, const char* word_key, const struct _gap_spans* spans, char* key) {
+	const char* begin = word_key;
+	int len, n, pos = 0, gap = 0;
+	while (*word_key) {
+		if (gap < spans->num && word_key - begin == spans->at[gap]) {
+			int min = spans->min[gap], max = spans->max[gap];
+			if (min == 1 && max == 1) key[pos++] = '?';
+			else if (min == max) pos += sprintf(key + pos, "{%d}", min);
+			else pos += sprintf(key + pos, "{%d,%d}", min, max);
+			word_key += spans->size[gap++];
+			continue;
+		}
+		n = read_char(ctx, word_key, (byte*)key + pos, &len);
+		word_key += n;
+		pos += len;
+	}
+	key[pos] = '\0';
+}
+
+//the scan of wf_search_word_category, every match is counted, return the matches(-1:out of memory, or WF_BUDGET_EXCEEDED)
+int
+wf_count_word(wordfilterctxptr ctx, struct wf_counter* counter, const char* word, uint32_t catmask) {
+	if (!ctx || !counter || !word) return 0;
+	const char* wordptr = word;
+	const char* allow_end = word;
+	const char* valid_end = scan_valid_end(ctx, word);
+	int find = 0;
+	uint32_t budget = ctx->budget, *budgetptr = budget ? &budget : NULL; //wf_set_budget
+	while (*wordptr) {
+		if (!may_match(ctx, wordptr)) {
+			wordptr += scan_step(wordptr, valid_end);
+			continue;
+		}
+		char word_key[MAX_WORD_LENGTH + 1] = {0};
+		struct _gap_spans spans;
+		uint32_t value = 0;
+		int allow = 0;
+		int ret = search_word(ctx, word, wordptr, word_key, catmask, &value, &allow, budgetptr, &spans);
+		if (wordptr + allow > allow_end) allow_end = wordptr + allow;
+		if (ret && wordptr + ret > allow_end) {
+			char key[(MAX_WORD_LENGTH + 1) * 4 + MAX_GAP_NUM * 8];
+			canonical_key(ctx, word_key, &spans, key);
+			if (!counter_add(counter, key, value & 0xFFFFFF, 1)) return -1;
+			find++;
+			wordptr += ret;
+		}
+		else {
+			wordptr += scan_step(wordptr, valid_end);
+		}
+		if (budgetptr && budget == 0) break;
+	}
+	return budgetptr && budget == 0 ? WF_BUDGET_EXCEEDED : find;
+}
+
+//add the counts of 'src' to 'dst'
+int
+wf_counter_merge(struct wf_counter* dst, struct wf_counter* src) {
+	if (!dst || !src) return 0;
+	uint32_t i;
+	for (i=0; i<src->size; i++)
+		if (src->entry[i].word && !counter_add(dst, src->entry[i].word, src->entry[i].value, src->entry[i].count))
+			return 0;
+	return 1;
+}
+
+uint64_t
+wf_counter_get(struct wf_counter* counter, const char* word) {
+	if (!counter || !word) return 0;
+	struct _count_entry* e = counter_find(counter, word, cache_hash(word, strlen(word)));
+	return e->word ? e->count : 0;
+}
+
+static int
+count_cmp(const void* a, const void* b) {
+	const struct wf_word_count* x = (const struct wf_word_count*)a;
+	const struct wf_word_count* y = (const struct wf_word_count*)b;
+	if (x->count != y->count) return x->count < y->count ? 1 : -1;
+	return strcmp(x->word, y->word);
+}
+
+/*
+ * the 'n' most counted words, most first, return the number filled.
+ * the words are owned by the counter. 'total'(or NULL):all matches, 'num'(or NULL):distinct words.
+ */
+uint32_t
+wf_counter_top(struct wf_counter* counter, struct wf_word_count* top, uint32_t n, uint64_t* total, uint32_t* num) {
+	if (!counter) return 0;
+	if (total) *total = counter->total;
+	if (num) *num = counter->num;
+	if (!top || n == 0 || counter->num == 0) return 0;
+	struct wf_word_count* all = (struct wf_word_count*)wf_malloc(sizeof(*all) * counter->num);
+	if (!all) return 0;
+	uint32_t i, k = 0;
+	for (i=0; i<counter->size; i++) {
+		struct _count_entry* e = &counter->entry[i];
+		if (!e->word) continue;
+		all[k].word = e->word;
+		all[k].count = e->count;
+		all[k].category = value_get_category(e->value);
+		all[k].severity = value_get_severity(e->value);
+		k++;
+	}
+	qsort(all, k, sizeof(*all), count_cmp);
+	if (n > k) n = k;
+	memcpy(top, all, sizeof(*all) * n);
+	wf_free(all, sizeof(*all) * counter->num);
+	return n;
+}
+
+#ifdef __linux__
+/*
+ * async filter for event loops:every worker drains its own lock free MPSC queue of jobs and pushes the
+ * results to its SPSC ring, an eventfd shared by the workers tells the loop to wf_async_poll.
+ * submit is thread safe, poll must be called by one thread at a time.
+ */
+#define MAX_ASYNC_THREAD 64
+
+struct _async_node {
+	struct _async_node* next;
+};
+
+//a job and its result, the text and the output follow it
+struct _async_job {
+	struct _async_node node;
+	wordfilterctxptr ctx;
+	uint32_t key;
+	int op;
+	uint32_t catmask;
+	int find;
+	uint32_t hitmask;
+	uint64_t tag;
+	size_t size;
+	char* outstr;
+	char text[];
+};
+
+//intrusive MPSC queue(Vyukov), producers exchange 'head', the worker pops from 'tail'
+struct _async_queue {
+	struct _async_node* head;
+	struct _async_node* tail;
+	struct _async_node stub;
+};
+
+struct _async_worker {
+	struct wf_async* async;
+	pthread_t tid;
+	sem_t sem;               //jobs in the queue
+	struct _async_queue queue;
+	struct _async_job** ring; //results, the worker writes 'ring_head', the poller 'ring_tail'
+	uint32_t ring_head;
+	uint32_t ring_tail;
+	uint32_t pending;        //submitted and not polled, at most the ring size so the ring never overflows
+};
+
+struct wf_async {
+	int fd;
+	int threads;             //workers running
+	int worker_num;
+	int stop;
+	int signaled;            //the eventfd is written and not polled yet
+	uint32_t size;           //ring size of a worker
+	uint32_t next;           //round robin of the submits
+	wf_async_acquire acquire;
+	wf_async_release release;
+	void* ud;
+	struct _async_worker* worker;
+};
+
+static void
+async_push(struct _async_queue* queue, struct _async_node* node) {
+	node->next = NULL;
+	struct _async_node* prev = __atomic_exchange_n(&queue->head, node, __ATOMIC_ACQ_REL);
+	__atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+}
+
+//NULL if empty or a push is not finished
+static struct _async_job*
+async_pop(struct _async_queue* queue) {
+	struct _async_node* tail = queue->tail;
+	struct _async_node* next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+	if (tail == &queue->stub) {
+		if (!next) return NULL;
+		queue->tail = next;
+		tail = next;
+		next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+	}
+	if (next) {
+		queue->tail = next;
+		return (struct _async_job*)tail;
+	}
+	if (tail != __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE)) return NULL;
+	async_push(queue, &queue->stub);
+	next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+	if (next) {
+		queue->tail = next;
+		return (struct _async_job*)tail;
+	}
+	return NULL;
+}
+
+static void
+async_signal(struct wf_async* async) {
+	if (!__atomic_exchange_n(&async->signaled, 1, __ATOMIC_SEQ_CST)) {
+		uint64_t one = 1;
+		while (write(async->fd, &one, sizeof(one)) < 0 && errno == EINTR);
+	}
+}
+
+static void
+async_do(struct wf_async* async, struct _async_job* job) {
+	wordfilterctxptr ctx = job->ctx ? job->ctx : async->acquire(async->ud, job->key);
+	if (!ctx) {
+		job->find = -1;
+		return;
+	}
+	if (job->op == WF_ASYNC_FILTER) {
+		job->outstr = job->text + strlen(job->text) + 1;
+		job->find = wf_filter_word_category(ctx, job->text, job->catmask, NULL, job->outstr, &job->hitmask);
+	} else {
+		job->find = wf_search_word_category(ctx, job->text, job->catmask, NULL, &job->hitmask);
+	}
+	if (!job->ctx) async->release(async->ud, job->key);
+}
+
+static void*
+async_run(void* arg) {
+	struct _async_worker* worker = (struct _async_worker*)arg;
+	struct wf_async* async = worker->async;
+	for (;;) {
+		while (sem_wait(&worker->sem) && errno == EINTR);
+		struct _async_job* job;
+		while (!(job = async_pop(&worker->queue))) {
+			if (__atomic_load_n(&async->stop, __ATOMIC_ACQUIRE)) return NULL;
+			sched_yield(); //a push in progress
+		}
+		async_do(async, job);
+		uint32_t head = worker->ring_head;
+		worker->ring[head & (async->size - 1)] = job;
+		__atomic_store_n(&worker->ring_head, head + 1, __ATOMIC_SEQ_CST);
+		async_signal(async);
+	}
+}
+
+static void
+async_free_job(struct _async_job* job) {
+	wf_free(job, job->size);
+}
+
+/*
+ * threads:workers, size:the jobs a worker holds until they are polled(rounded up to a power of 2).
+ * acquire/release(or NULL):get the context of a job submitted without one by its key in the worker,
+ * e.g. under a lock of the caller, acquire returns NULL if it is gone.
+ */
+struct wf_async*
+wf_async_create(int threads, uint32_t size, wf_async_acquire acquire, wf_async_release release, void* ud) {
+	if (threads < 1) threads = 1;
+	if (threads > MAX_ASYNC_THREAD) threads = MAX_ASYNC_THREAD;
+	if (size < 2) size = 2;
+	if (size > 0x100000) size = 0x100000;
+	size = twoto(ceil_log2(size - 1));
+
+	struct wf_async* async = (struct wf_async*)wf_malloc(sizeof(*async));
+	if (!async) return NULL;
+	memset(async, 0, sizeof(*async));
+	async->size = size;
+	async->acquire = acquire;
+	async->release = release;
+	async->ud = ud;
+	async->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	async->worker_num = threads;
+	async->worker = (struct _async_worker*)wf_malloc(sizeof(struct _async_worker) * threads);
+	if (async->fd < 0 || !async->worker) {
+		wf_async_free(async);
+		return NULL;
+	}
+	memset(async->worker, 0, sizeof(struct _async_worker) * threads);
+	int i;
+	for (i=0; i<threads; i++) {
+		struct _async_worker* worker = &async->worker[i];
+		worker->async = async;
+		worker->queue.head = worker->queue.tail = &worker->queue.stub;
+		worker->ring = (struct _async_job**)wf_malloc(sizeof(struct _async_job*) * size);
+		if (!worker->ring || sem_init(&worker->sem, 0, 0)) {
+			if (worker->ring) wf_free(worker->ring, sizeof(struct _async_job*) * size);
+			break;
+		}
+		if (pthread_create(&worker->tid, NULL, async_run, worker)) {
+			sem_destroy(&worker->sem);
+			wf_free(worker->ring, sizeof(struct _async_job*) * size);
+			break;
+		}
+		async->threads++;
+	}
+	if (async->threads < threads) {
+		wf_async_free(async);
+		return NULL;
+	}
+	return async;
+}
+
+//the queued jobs are finished first, the results not polled are dropped
+void
+wf_async_free(struct wf_async* async) {
+	if (!async) return;
+	__atomic_store_n(&async->stop, 1, __ATOMIC_RELEASE);
+	int i;
+	for (i=0; i<async->threads; i++)
+		sem_post(&async->worker[i].sem);
+	for (i=0; i<async->threads; i++) {
+		struct _async_worker* worker = &async->worker[i];
+		pthread_join(worker->tid, NULL);
+		for (; worker->ring_tail != worker->ring_head; worker->ring_tail++)
+			async_free_job(worker->ring[worker->ring_tail & (async->size - 1)]);
+		sem_destroy(&worker->sem);
+		wf_free(worker->ring, sizeof(struct _async_job*) * async->size);
+	}
+	if (async->worker) wf_free(async->worker, sizeof(struct _async_worker) * async->worker_num);
+	if (async->fd >= 0) close(async->fd);
+	wf_free(async, sizeof(*async));
+}
+
+//readable when there are results to poll
+int
+wf_async_fd(struct wf_async* async) {
+	return async ? async->fd : -1;
+}
+
+/*
+ * queue a WF_ASYNC_CHECK(wf_search_word_category) or WF_ASYNC_FILTER(wf_filter_word_category) of 'text',
+ * 'tag' comes back with the result. ctx:the context, or NULL to acquire it by 'key'.
+ * the context must not change while the job runs, unless acquire/release lock it.
+ * return 0 if the workers hold too many results or out of memory, it never blocks.
+ */
+int
+wf_async_submit(struct wf_async* async, wordfilterctxptr ctx, uint32_t key, int op,
+	const char* text, uint32_t catmask, uint64_t tag) {
+	if (!async || !text || (!ctx && !async->acquire)) return 0;
+	struct _async_worker* worker = NULL;
+	uint32_t start = __sync_fetch_and_add(&async->next, 1);
+	int i;
+	for (i=0; i<async->threads && !worker; i++) {
+		struct _async_worker* w = &async->worker[(start + i) % async->threads];
+		uint32_t pending = __atomic_load_n(&w->pending, __ATOMIC_RELAXED);
+		while (pending < async->size) {
+			if (__atomic_compare_exchange_n(&w->pending, &pending, pending + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+				worker = w;
+				break;
+			}
+		}
+	}
+	if (!worker) return 0;
+
+	size_t len = strlen(text);
+	size_t size = sizeof(struct _async_job) + (len + 1) * (op == WF_ASYNC_FILTER ? 2 : 1);
+	struct _async_job* job = (struct _async_job*)wf_malloc(size);
+	if (!job) {
+		__sync_sub_and_fetch(&worker->pending, 1);
+		return 0;
+	}
+	memset(job, 0, sizeof(*job));
+	job->ctx = ctx;
+	job->key = key;
+	job->op = op;
+	job->catmask = catmask;
+	job->tag = tag;
+	job->size = size;
+	memcpy(job->text, text, len + 1);
+	async_push(&worker->queue, &job->node);
+	sem_post(&worker->sem);
+	return 1;
+}
+
+/*
+ * take at most 'max' results, free each by wf_async_free_result. the eventfd is read here,
+ * it is written again if results are left.
+ */
+int
+wf_async_poll(struct wf_async* async, struct wf_async_result* results, int max) {
+	if (!async || !results || max <= 0) return 0;
+	uint64_t count;
+	while (read(async->fd, &count, sizeof(count)) < 0 && errno == EINTR);
+	__atomic_store_n(&async->signaled, 0, __ATOMIC_SEQ_CST);
+
+	int num = 0, left = 0, i;
+	for (i=0; i<async->threads; i++) {
+		struct _async_worker* worker = &async->worker[i];
+		uint32_t head = __atomic_load_n(&worker->ring_head, __ATOMIC_SEQ_CST);
+		for (; worker->ring_tail != head && num < max; worker->ring_tail++) {
+			struct _async_job* job = worker->ring[worker->ring_tail & (async->size - 1)];
+			struct wf_async_result* result = &results[num++];
+			result->tag = job->tag;
+			result->find = job->find;
+			result->hitmask = job->hitmask;
+			result->outstr = job->outstr;
+			result->job = job;
+			__sync_sub_and_fetch(&worker->pending, 1);
+		}
+		if (worker->ring_tail != head) left = 1;
+	}
+	if (left) async_signal(async);
+	return num;
+}
+
+void
+wf_async_free_result(struct wf_async_result* result) {
+	if (!result || !result->job) return;
+	async_free_job(result->job);
+	result->job = NULL;
+	result->outstr = NULL;
 }
+#endif
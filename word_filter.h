@@ -6,10 +6,21 @@
 #include <stdint.h>
 #include <assert.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef unsigned char byte;
 
+#define WF_CATEGORY_DEFAULT 0x0001
+#define WF_CATEGORY_ALL     0xFFFF
+#define WF_MAX_WORD_LENGTH  0xFF
+#define WF_BUDGET_EXCEEDED  (-2) //a scan ran out of the steps of wf_set_budget
+#define WF_CACHE_MISS       (-1) //wf_cache_lookup
+
 typedef struct _trie {
 	uint32_t data;
+	uint32_t value; //word payload:category(16) | severity(8) | flags(8), a node is 8 bytes
 }*trieptr;
 
 struct _trie_pool_free_node {
@@ -32,17 +43,53 @@ struct _trie_pool {
 
 typedef struct _str_node {
 	char* str;
+	uint16_t category;
+	byte severity;
 	struct _str_node* next;
 }*strnodeptr;
 
+//[start, end) byte offsets of the masked bytes, 2 uint32_t per span
+struct wf_span_list {
+	uint32_t* span;
+	uint32_t num;  //spans
+	uint32_t size; //capacity in spans
+};
+
+struct _equiv_map;
+struct _shm_map;
+struct _qgram;
+struct _wide_trie;
+struct wf_cache;
+
 typedef struct _wordfilter_ctx {
 	struct _trie word_root;
 	struct _trie skip_word_root;
 	int ignorecase;
+	int readonly; //the tries can't change(wf_minimize, wf_open_static, wf_shm_attach), inserts go to 'overlay'
+	int borrowed; //the pools are not owned by the context
 	char mask_word;
+	int utf8; //the scans step by utf8 characters instead of bytes(wf_set_utf8)
+	uint32_t budget; //the trie steps a scan call may take, 0:no limit(wf_set_budget)
 	struct _trie_pool pool[8];
+	struct _wordfilter_ctx* overlay;
+	struct _equiv_map* equiv; //character equivalence classes, NULL if none
+	struct _shm_map* shm; //the shared memory generation the pools are mapped from
+	uint64_t generation; //changes with the words and settings, unique among all contexts
+	struct _qgram* qgram; //the leading bytes of the words, to pass over the positions no word starts at
+	struct _wide_trie* wide; //code point mode(wf_set_codepoint), the words are kept here instead of 'word_root'
 }*wordfilterctxptr;
 
+//a dictionary compiled into const data by wf_dump_static
+struct wf_static_dict {
+	struct _trie word_root;
+	struct _trie skip_word_root;
+	int ignorecase;
+	const struct _trie* pool[8];
+	uint32_t pool_size[8];
+	const uint32_t* equiv; //(variant, canonical) code point pairs
+	uint32_t equiv_num;
+};
+
 size_t wf_get_memsize();
 void* wf_malloc(size_t size);
 void wf_free(void* p, size_t size);
@@ -51,19 +98,134 @@ void wf_free_str_list(strnodeptr strlist);
 
 wordfilterctxptr wf_create_ctx();
 void wf_clean_ctx(wordfilterctxptr ctx);
+wordfilterctxptr wf_clone_ctx(wordfilterctxptr ctx);
+size_t wf_compact(wordfilterctxptr ctx);
+size_t wf_minimize(wordfilterctxptr ctx);
+int wf_dump_static(wordfilterctxptr ctx, const char* name, FILE* fp);
+wordfilterctxptr wf_open_static(const struct wf_static_dict* dict);
+#ifndef _WIN32
+uint64_t wf_shm_publish(wordfilterctxptr ctx, const char* name);
+wordfilterctxptr wf_shm_attach(const char* name);
+int wf_shm_stale(wordfilterctxptr ctx);
+int wf_shm_unlink(const char* name);
+#endif
 void wf_free_ctx(wordfilterctxptr ctx);
 
 int wf_word_isempty(wordfilterctxptr ctx);
 int wf_skipword_isempty(wordfilterctxptr ctx);
 int wf_insert_word(wordfilterctxptr ctx, const char* word);
+int wf_insert_word_ex(wordfilterctxptr ctx, const char* word,
+	uint16_t category, byte severity);
+int wf_insert_words(wordfilterctxptr ctx, const char** words, size_t num,
+	uint16_t category, byte severity, int threads);
 int wf_insert_skip_word(wordfilterctxptr ctx, const char* word);
+int wf_insert_allow_word(wordfilterctxptr ctx, const char* word);
+int wf_insert_pattern(wordfilterctxptr ctx, const char* pattern,
+	uint16_t category, byte severity);
+int wf_insert_whole_word(wordfilterctxptr ctx, const char* word,
+	uint16_t category, byte severity);
+/*
+ * the searches below(wf_search_word* wf_filter_word* wf_filter_span wf_match_at wf_count_word) only read the context,
+ * they are reentrant:any number of threads may search one context at once while no thread changes it.
+ * the functions that change a context(insert, set, compact, clean...) need it alone, e.g. by wf_brlock.
+ */
 int wf_search_word(wordfilterctxptr ctx, const char* word, 
 	char* word_key);
 int wf_search_word_ex(wordfilterctxptr ctx, const char* word, 
 	strnodeptr* strlist);
 int wf_filter_word(wordfilterctxptr ctx, const char* word, 
 	strnodeptr* strlist, char *outstr);
+int wf_search_word_category(wordfilterctxptr ctx, const char* word,
+	uint32_t catmask, strnodeptr* strlist, uint32_t* hitmask);
+int wf_filter_word_category(wordfilterctxptr ctx, const char* word,
+	uint32_t catmask, strnodeptr* strlist, char* outstr, uint32_t* hitmask);
+int wf_filter_span(wordfilterctxptr ctx, const char* word,
+	uint32_t catmask, struct wf_span_list* spans, uint32_t* hitmask);
+//the same scans with the budget of this call instead of wf_set_budget(0:no limit)
+int wf_search_word_budget(wordfilterctxptr ctx, const char* word,
+	uint32_t catmask, strnodeptr* strlist, uint32_t* hitmask, uint32_t budget);
+int wf_filter_word_budget(wordfilterctxptr ctx, const char* word,
+	uint32_t catmask, strnodeptr* strlist, char* outstr, uint32_t* hitmask, uint32_t budget);
+int wf_filter_span_budget(wordfilterctxptr ctx, const char* word,
+	uint32_t catmask, struct wf_span_list* spans, uint32_t* hitmask, uint32_t budget);
+void wf_free_span_list(struct wf_span_list* spans);
 void wf_set_ignore_case(wordfilterctxptr ctx, int is_ignore);
 void wf_set_mask_word(wordfilterctxptr ctx, char mask_word);
+int wf_set_codepoint(wordfilterctxptr ctx, int enable);
+void wf_set_utf8(wordfilterctxptr ctx, int enable);
+void wf_set_budget(wordfilterctxptr ctx, uint32_t budget);
+size_t wf_utf8_valid(const char* str, size_t len);
+int wf_add_equiv(wordfilterctxptr ctx, const char* canonical, const char* variants);
+int wf_match_at(wordfilterctxptr ctx, const char* begin, const char* word, char* word_key,
+	uint32_t catmask, uint32_t* value, int* allow);
+
+//a reader-writer lock for a context, its readers don't share a cache line(no nested read locks)
+struct wf_brlock;
+struct wf_brlock* wf_brlock_create();
+void wf_brlock_free(struct wf_brlock* lock);
+void wf_brlock_rlock(struct wf_brlock* lock);
+void wf_brlock_runlock(struct wf_brlock* lock);
+void wf_brlock_wlock(struct wf_brlock* lock);
+void wf_brlock_wunlock(struct wf_brlock* lock);
+
+struct wf_cache* wf_cache_create(uint32_t size);
+void wf_cache_free(struct wf_cache* cache);
+void wf_cache_stat(struct wf_cache* cache, uint64_t* hit, uint64_t* miss);
+int wf_cache_search_word(struct wf_cache* cache, wordfilterctxptr ctx, const char* word,
+	uint32_t catmask, strnodeptr* strlist, uint32_t* hitmask);
+int wf_cache_filter_word(struct wf_cache* cache, wordfilterctxptr ctx, const char* word,
+	uint32_t catmask, strnodeptr* strlist, char* outstr, uint32_t* hitmask);
+int wf_cache_lookup(struct wf_cache* cache, wordfilterctxptr ctx, const char* word,
+	uint32_t catmask, strnodeptr* strlist, char* outstr, uint32_t* hitmask);
+void wf_cache_store(struct wf_cache* cache, wordfilterctxptr ctx, const char* word,
+	uint32_t catmask, int find, strnodeptr strlist, const char* outstr, uint32_t hitmask);
+
+struct wf_counter;
+
+struct wf_word_count {
+	const char* word;
+	uint64_t count;
+	uint16_t category;
+	byte severity;
+};
+
+struct wf_counter* wf_counter_create();
+void wf_counter_free(struct wf_counter* counter);
+int wf_count_word(wordfilterctxptr ctx, struct wf_counter* counter, const char* word, uint32_t catmask);
+int wf_counter_merge(struct wf_counter* dst, struct wf_counter* src);
+uint64_t wf_counter_get(struct wf_counter* counter, const char* word);
+uint32_t wf_counter_top(struct wf_counter* counter, struct wf_word_count* top, uint32_t n,
+	uint64_t* total, uint32_t* num);
+
+#ifdef __linux__
+#define WF_ASYNC_CHECK  0
+#define WF_ASYNC_FILTER 1
+
+struct wf_async;
+struct _async_job;
+
+struct wf_async_result {
+	uint64_t tag;
+	int find;           //-1:the context of the key is gone, or WF_BUDGET_EXCEEDED
+	uint32_t hitmask;
+	const char* outstr; //the masked text of WF_ASYNC_FILTER
+	struct _async_job* job;
+};
+
+typedef wordfilterctxptr (*wf_async_acquire)(void* ud, uint32_t key);
+typedef void (*wf_async_release)(void* ud, uint32_t key);
+
+struct wf_async* wf_async_create(int threads, uint32_t size,
+	wf_async_acquire acquire, wf_async_release release, void* ud);
+void wf_async_free(struct wf_async* async);
+int wf_async_fd(struct wf_async* async);
+int wf_async_submit(struct wf_async* async, wordfilterctxptr ctx, uint32_t key, int op,
+	const char* text, uint32_t catmask, uint64_t tag);
+int wf_async_poll(struct wf_async* async, struct wf_async_result* results, int max);
+void wf_async_free_result(struct wf_async_result* result);
+#endif
 
+#ifdef __cplusplus
+}
+#endif
 #endif //__WORD_FILTER_H
\ No newline at end of file
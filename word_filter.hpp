@@ -0,0 +1,369 @@
+/*
+ * C++17 wrapper of word_filter.h, header only.
+ * The scan kernels are templates specialized on case folding, skip words and the output,
+ * contexts with equivalence classes, layered words or code points, and positions that reach a pattern gap,
+ * are matched by the C library(wf_match_at).
+ */
+#ifndef __WORD_FILTER_HPP
+#define __WORD_FILTER_HPP
+#include <string>
+#include <string_view>
+#include <utility>
+#include "word_filter.h"
+#include "word_filter_node.h"
+
+namespace wf {
+
+namespace detail {
+
+//the node layout of word_filter_node.h
+inline uint32_t node_data(const _trie* n) { return trie_get_data(n); }
+inline bool node_isword(const _trie* n) { return trie_get_isword(n); }
+inline bool node_chain(const _trie* n) { return trie_get_chain(n); }
+inline bool node_gap(const _trie* n) { return trie_get_gap(n); }
+inline uint32_t node_category(const _trie* n) { return trie_get_category(n); }
+inline uint32_t node_capacity(const _trie* n) { return trie_get_capacity(n); }
+inline const _trie* node_children(const _trie_pool* pool, const _trie* n) { return trie_get_children(pool, n); }
+inline const byte* chain_label(const _trie* children) { return trie_get_chain_label(children); }
+constexpr uint32_t flag_allow = WORD_FLAG_ALLOW;
+constexpr uint32_t flag_whole = WORD_FLAG_WHOLE;
+constexpr byte gap_mark = GAP_MARK;
+
+inline byte fold(byte c) { return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c; }
+
+//the size of the utf8 character by its lead byte, get_utf8_size of word_filter.c
+inline int utf8_size(char c) {
+	int n = 0;
+	while (c & (0x80 >> n) && n < 4) n++;
+	return n ? n : 1;
+}
+
+inline const _trie* step(const _trie_pool* pool, const _trie* node, int& pos, byte c) {
+	const _trie* children = node_children(pool, node);
+	if (!children) return nullptr;
+	if (node_chain(node)) {
+		const byte* label = chain_label(children);
+		if (pos < label[0]) {
+			if (label[pos + 1] != c) return nullptr;
+			pos++;
+			return node;
+		}
+		if (node_data(children) != c) return nullptr;
+		pos = 0;
+		return children;
+	}
+	int l = 0, r = node_capacity(node) - 1;
+	while (l <= r) {
+		int middle = (l + r) >> 1;
+		uint32_t data = node_data(&children[middle]);
+		if (data == 0 || data > c) r = middle - 1;
+		else if (data == c) return &children[middle];
+		else l = middle + 1;
+	}
+	return nullptr;
+}
+
+inline bool is_word_char(uint32_t cp) {
+	if (cp < 0x80) return (cp >= '0' && cp <= '9') || ((cp | 0x20) >= 'a' && (cp | 0x20) <= 'z') || cp == '_';
+	return (cp >= 0xC0 && cp <= 0x24F && cp != 0xD7 && cp != 0xF7) || (cp >= 0x370 && cp <= 0x52F);
+}
+
+//the code point at 'p', an invalid byte is not a word character
+inline uint32_t decode(const char* p, const char* end, int& n) {
+	byte c = p[0];
+	n = 1;
+	if (c < 0x80) return c;
+	int size = c >= 0xF8 ? 0 : c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 0;
+	if (size == 0 || end - p < size) return 0x80000000;
+	uint32_t v = c & (0x3F >> (size - 1));
+	for (int i = 1; i < size; i++) {
+		if ((p[i] & 0xC0) != 0x80) return 0x80000000;
+		v = (v << 6) | (p[i] & 0x3F);
+	}
+	n = size;
+	return v;
+}
+
+inline bool boundary_before(const char* begin, const char* p) {
+	if (p == begin) return true;
+	const char* q = p - 1;
+	while (q > begin && p - q < 4 && (*q & 0xC0) == 0x80) q--;
+	int n;
+	uint32_t cp = decode(q, p, n);
+	return q + n != p || !is_word_char(cp);
+}
+
+inline bool boundary_after(const char* p, const char* end) {
+	if (p == end) return true;
+	int n;
+	return !is_word_char(decode(p, end, n));
+}
+
+template <bool IgnoreCase>
+int skip_len(const wordfilterctxptr ctx, const char* p, const char* end) {
+	const _trie* node = &ctx->skip_word_root;
+	int pos = 0, find = 0;
+	for (const char* q = p; q < end; q++) {
+		byte c = IgnoreCase ? fold(*q) : *q;
+		node = step(ctx->pool, node, pos, c);
+		if (!node) break;
+		if (pos == 0 && node_isword(node)) find = q + 1 - p;
+	}
+	return find;
+}
+
+struct match_result {
+	int len;     //the bytes the match spans, skip words included
+	int allow;   //the longest allowed word here
+	uint32_t value;
+	bool fallback; //reached a pattern gap, match it in C
+};
+
+//the longest match at 'p', the same walk as do_search_word
+template <bool IgnoreCase, bool HasSkip, bool NeedKey>
+match_result match(const wordfilterctxptr ctx, const char* begin, const char* p, const char* end,
+	uint32_t catmask, char* key) {
+	match_result res = {0, 0, 0, false};
+	const _trie_pool* pool = ctx->pool;
+	const _trie* node = &ctx->word_root;
+	const char* q = p;
+	int find = 0, key_index = 0, skip_num = 0, pos = 0, start = -1;
+
+	while (q < end) {
+		if (pos > 0 || (node_chain(node) && node_children(pool, node))) {
+			const byte* label = chain_label(node_children(pool, node)) + 1;
+			int label_len = label[-1];
+			while (pos < label_len && q < end) {
+				byte c = IgnoreCase ? fold(*q) : *q;
+				if (c != label[pos]) break;
+				if constexpr (NeedKey) key[key_index] = *q;
+				key_index++;
+				q++;
+				pos++;
+			}
+			if (q == end) break;
+		}
+		if (key_index + 1 > WF_MAX_WORD_LENGTH) break;
+		byte c = IgnoreCase ? fold(*q) : *q;
+		int next_pos = pos;
+		const _trie* next = c == gap_mark ? nullptr : step(pool, node, next_pos, c);
+		if (!next) {
+			if constexpr (HasSkip) {
+				int skip = skip_len<IgnoreCase>(ctx, q, end);
+				if (skip) {
+					skip_num += skip;
+					q += skip;
+					continue;
+				}
+			}
+			break;
+		}
+		if constexpr (NeedKey) key[key_index] = *q;
+		key_index++;
+		node = next;
+		pos = next_pos;
+		q++;
+
+		if (pos != 0) continue;
+		if (node_gap(node)) {
+			res.fallback = true;
+			return res;
+		}
+		if (!node_isword(node)) continue;
+		if (node_category(node) & catmask) {
+			bool whole = !(node->value & flag_whole);
+			if (!whole) {
+				if (start < 0) start = boundary_before(begin, p);
+				whole = start && boundary_after(q, end);
+			}
+			if (whole) {
+				find = key_index;
+				res.value = node->value;
+			}
+		}
+		if (node->value & flag_allow) res.allow = q - p;
+	}
+	if constexpr (NeedKey) key[find] = 0;
+	res.len = find ? find + skip_num : 0;
+	return res;
+}
+
+//the scan loop of wf_search_word_category/wf_filter_word_category, 'Fast' uses the kernel above
+template <bool Fast, bool IgnoreCase, bool HasSkip, class Sink>
+bool scan(const wordfilterctxptr ctx, std::string_view text, uint32_t catmask, Sink& sink) {
+	constexpr bool need_key = Sink::need_key;
+	const char* begin = text.data();
+	const char* end = begin + text.size();
+	const char* allow_end = begin;
+	const char* valid_end = ctx->utf8 ? begin + wf_utf8_valid(begin, text.size()) : begin;
+	std::string copy; //the C library needs a terminated string
+	bool find = false;
+	char key[WF_MAX_WORD_LENGTH + 1];
+
+	const char* p = begin;
+	while (p < end) {
+		match_result res = {0, 0, 0, !Fast};
+		if constexpr (Fast)
+			res = match<IgnoreCase, HasSkip, need_key>(ctx, begin, p, end, catmask, key);
+		if (res.fallback) {
+			if (copy.empty()) copy.assign(begin, end);
+			const char* cbegin = copy.c_str();
+			res.len = wf_match_at(ctx, cbegin, cbegin + (p - begin), need_key ? key : nullptr,
+				catmask, &res.value, &res.allow);
+		}
+		if (p + res.allow > allow_end) allow_end = p + res.allow;
+		if (res.len && p + res.len > allow_end) {
+			find = true;
+			if (!sink.match(p, res.len, std::string_view(need_key ? key : "", need_key ? strlen(key) : 0), res.value))
+				return true;
+			p += res.len;
+		} else {
+			int n = p < valid_end ? utf8_size(*p) : 1;
+			for (; n; n--)
+				sink.plain(*p++);
+		}
+	}
+	return find;
+}
+
+template <class Sink>
+bool dispatch(const wordfilterctxptr ctx, std::string_view text, uint32_t catmask, Sink& sink) {
+	if (!ctx) return false;
+	if (ctx->equiv || ctx->wide || (ctx->overlay && (!wf_word_isempty(ctx->overlay) || !wf_skipword_isempty(ctx->overlay))))
+		return scan<false, false, false>(ctx, text, catmask, sink);
+	bool skip = !wf_skipword_isempty(ctx);
+	if (ctx->ignorecase)
+		return skip ? scan<true, true, true>(ctx, text, catmask, sink) : scan<true, true, false>(ctx, text, catmask, sink);
+	return skip ? scan<true, false, true>(ctx, text, catmask, sink) : scan<true, false, false>(ctx, text, catmask, sink);
+}
+
+struct check_sink {
+	static constexpr bool need_key = false;
+	bool match(const char*, int, std::string_view, uint32_t) { return false; }
+	void plain(char) {}
+};
+
+template <class F>
+struct each_sink {
+	static constexpr bool need_key = true;
+	const char* begin;
+	F& f;
+	bool match(const char* p, int len, std::string_view word, uint32_t value) {
+		f(size_t(p - begin), size_t(len), word, uint16_t(value_get_category(value)), byte(value_get_severity(value)));
+		return true;
+	}
+	void plain(char) {}
+};
+
+struct mask_sink {
+	static constexpr bool need_key = true;
+	std::string& out;
+	char mask_word;
+	uint32_t hit;
+	bool match(const char* p, int len, std::string_view word, uint32_t value) {
+		//the same as _fill_outstr:the skip words between stay
+		size_t index = 0;
+		int i = 0;
+		while (i < len) {
+			char c = p[i];
+			if (index < word.size() && word[index] == c) {
+				out.push_back(mask_word);
+				int n = utf8_size(c);
+				index += n;
+				i += n;
+			} else {
+				out.push_back(c);
+				i++;
+			}
+		}
+		hit |= value_get_category(value);
+		return true;
+	}
+	void plain(char c) { out.push_back(c); }
+};
+
+} // namespace detail
+
+//owns a context, frees it at the end
+class filter {
+public:
+	filter() : ctx_(wf_create_ctx()) {}
+	explicit filter(wordfilterctxptr ctx) : ctx_(ctx) {}
+	filter(filter&& other) noexcept : ctx_(std::exchange(other.ctx_, nullptr)) {}
+	filter& operator=(filter&& other) noexcept {
+		if (this != &other) {
+			wf_free_ctx(ctx_);
+			ctx_ = std::exchange(other.ctx_, nullptr);
+		}
+		return *this;
+	}
+	filter(const filter&) = delete;
+	filter& operator=(const filter&) = delete;
+	~filter() { wf_free_ctx(ctx_); }
+
+	static filter open_static(const wf_static_dict& dict) { return filter(wf_open_static(&dict)); }
+#ifndef _WIN32
+	static filter shm_attach(const std::string& name) { return filter(wf_shm_attach(name.c_str())); }
+	bool shm_stale() const { return wf_shm_stale(ctx_); }
+	uint64_t shm_publish(const std::string& name) const { return wf_shm_publish(ctx_, name.c_str()); }
+#endif
+
+	explicit operator bool() const { return ctx_ != nullptr; }
+	wordfilterctxptr get() const { return ctx_; }
+	wordfilterctxptr release() { return std::exchange(ctx_, nullptr); }
+
+	filter clone() const { return filter(wf_clone_ctx(ctx_)); }
+	size_t compact() { return wf_compact(ctx_); }
+	size_t minimize() { return wf_minimize(ctx_); }
+	void clean() { wf_clean_ctx(ctx_); }
+
+	void set_ignore_case(bool ignore) { wf_set_ignore_case(ctx_, ignore); }
+	bool set_codepoint(bool enable) { return wf_set_codepoint(ctx_, enable); }
+	void set_mask_word(char mask_word) { wf_set_mask_word(ctx_, mask_word); }
+	bool add_equiv(std::string_view canonical, std::string_view variants) {
+		return wf_add_equiv(ctx_, std::string(canonical).c_str(), std::string(variants).c_str());
+	}
+
+	bool insert_word(std::string_view word, uint16_t category = WF_CATEGORY_DEFAULT, byte severity = 0) {
+		return wf_insert_word_ex(ctx_, std::string(word).c_str(), category, severity);
+	}
+	bool insert_whole_word(std::string_view word, uint16_t category = WF_CATEGORY_DEFAULT, byte severity = 0) {
+		return wf_insert_whole_word(ctx_, std::string(word).c_str(), category, severity);
+	}
+	bool insert_pattern(std::string_view pattern, uint16_t category = WF_CATEGORY_DEFAULT, byte severity = 0) {
+		return wf_insert_pattern(ctx_, std::string(pattern).c_str(), category, severity);
+	}
+	bool insert_skip_word(std::string_view word) { return wf_insert_skip_word(ctx_, std::string(word).c_str()); }
+	bool insert_allow_word(std::string_view word) { return wf_insert_allow_word(ctx_, std::string(word).c_str()); }
+	bool empty() const { return wf_word_isempty(ctx_); }
+
+	//is there any word of 'catmask' in 'text', stops at the first one
+	bool check(std::string_view text, uint32_t catmask = WF_CATEGORY_ALL) const {
+		detail::check_sink sink;
+		return detail::dispatch(ctx_, text, catmask, sink);
+	}
+
+	//f(size_t pos, size_t len, std::string_view word, uint16_t category, byte severity) for every match
+	template <class F>
+	bool for_each(std::string_view text, F&& f, uint32_t catmask = WF_CATEGORY_ALL) const {
+		detail::each_sink<F> sink{text.data(), f};
+		return detail::dispatch(ctx_, text, catmask, sink);
+	}
+
+	//'text' with the words of 'catmask' masked, 'hitmask' gets their categories
+	std::string mask(std::string_view text, uint32_t catmask = WF_CATEGORY_ALL, uint32_t* hitmask = nullptr) const {
+		std::string out;
+		out.reserve(text.size());
+		detail::mask_sink sink{out, ctx_ ? ctx_->mask_word : '*', 0};
+		detail::dispatch(ctx_, text, catmask, sink);
+		if (hitmask) *hitmask = sink.hit & catmask;
+		return out;
+	}
+
+private:
+	wordfilterctxptr ctx_;
+};
+
+} // namespace wf
+
+#endif //__WORD_FILTER_HPP
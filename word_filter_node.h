@@ -0,0 +1,76 @@
+#ifndef __WORD_FILTER_NODE_H
+#define __WORD_FILTER_NODE_H
+#include "word_filter.h"
+
+/*
+ * the node layout of the tries, used by word_filter.c and the scan kernels of word_filter.hpp.
+ * data:byte(8) | isword(1) | capacity(3) | children index(20)
+ * value:category(16) | severity(8) | word flags(4) | reserved(2) | gap(1) | chain(1)
+ */
+#define MAX_INDEX 0xFFFFF //children index
+
+#define twoto(x) (1<<(x))
+static inline uint32_t
+ceil_log2(uint32_t x) {
+	int i = 0;
+	while (x) {x=x>>1; ++i;}
+	return i;
+}
+
+#define trie_get_data(n)               ( (n)->data & 0xFF )
+#define trie_get_isword(n)             ( ((n)->data & 0x100) >> 8 )
+#define trie_get_capacity_pool(n)      ( (((n)->data & 0xE00) >> 9))
+#define trie_get_capacity(n)           ( twoto(trie_get_capacity_pool(n)+1) - 1 )
+#define trie_get_children_index(n)     ( ((n)->data & 0xFFFFF000) >> 12 )
+#define trie_get_children(pool, node)  pool_get_trie((pool), trie_get_capacity_pool(node), trie_get_children_index(node))
+
+#define trie_set_data(n, v)            ( (n)->data = ((n)->data & 0xFFFFFF00) | ((v) & 0xFF) )
+#define trie_set_isword(n, v)          ( (n)->data = ((n)->data & 0xFFFFFEFF) | (((v) & 0x1) << 8) )
+#define trie_set_rawcapacity(n, v)     ( (n)->data = ((n)->data & 0xFFFFF1FF) | (((v) & 0x7) << 9) )
+#define trie_set_capacity(n, v)        trie_set_rawcapacity( n, ceil_log2((v))-1 ) /*v:1~255*/
+#define trie_set_children_index(n, v)  ( (n)->data = ((n)->data & 0x00000FFF) | (((v) & 0xFFFFF) << 12) )
+
+#define value_get_category(v)          ( (v) & 0xFFFF )
+#define value_get_severity(v)          ( ((v) & 0xFF0000) >> 16 )
+#define trie_get_category(n)           value_get_category((n)->value)
+#define trie_get_severity(n)           value_get_severity((n)->value)
+#define trie_get_chain(n)              ( ((n)->value & 0x80000000) >> 31 )
+#define trie_get_gap(n)                ( ((n)->value & 0x40000000) >> 30 )
+#define trie_get_word_flag(n)          ( (n)->value & 0x0F000000 )
+#define trie_make_value(cat, sev)      ( ((uint32_t)(cat) & 0xFFFF) | (((uint32_t)(sev) & 0xFF) << 16) )
+
+//word flags(value bits 24~27)
+#define WORD_FLAG_ALLOW                0x01000000 /*exempts the banned words it covers*/
+#define WORD_FLAG_WHOLE                0x02000000 /*only matches at word boundaries*/
+
+#define trie_set_payload(n, v)         ( (n)->value = ((n)->value & 0xF0000000) | ((v) & 0x0FFFFFFF) )
+#define trie_set_chain(n, v)           ( (n)->value = ((n)->value & 0x7FFFFFFF) | (((uint32_t)(v) & 0x1) << 31) )
+#define trie_set_gap(n)                ( (n)->value |= 0x40000000 )
+
+/*
+ * gap:a run of min~max arbitrary characters in a pattern, stored as three nodes
+ * GAP_MARK -> min+1 -> max+1, the node before them has the gap flag.
+ * 0xFF never appears in utf8, so no word can step into a gap by its bytes.
+ */
+#define GAP_MARK 0xFF
+
+/*
+ * chain node:a run of single-child nodes stored in one children block.
+ * slot 0 is the real node at the end of the run, the bytes in between follow it:
+ * label[0] is the number of bytes, label[1..n] the bytes.
+ */
+#define trie_get_chain_label(children) ( (byte*)((children) + 1) )
+#define get_chain_block_size(label_len) ( 1 + ((label_len) + sizeof(struct _trie)) / sizeof(struct _trie) )
+#define MAX_CHAIN_LENGTH 0xFF
+
+#define get_pool_unit_size(pool_index) ( sizeof(struct _trie)*(twoto(pool_index+1)-1) )/*pool_index:0~7*/
+
+static inline trieptr
+pool_get_trie(const struct _trie_pool pool[8], uint32_t pool_index, uint32_t index) {
+	const struct _trie_pool* mypool = &pool[pool_index];
+	if (mypool->pool == NULL || index == 0) return NULL;
+	index--;
+	return &mypool->pool[index * (twoto(pool_index+1)-1)];
+}
+
+#endif //__WORD_FILTER_NODE_H